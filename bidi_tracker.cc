@@ -21,6 +21,10 @@ bool BidiTracker::ListensToConnections() const {
   return false;
 }
 
+base::flat_set<std::string> BidiTracker::GetListenedEventMethods() const {
+  return {"Runtime.bindingCalled"};
+}
+
 Status BidiTracker::OnEvent(DevToolsClient* client,
                             const std::string& method,
                             const base::DictionaryValue& params) {
@@ -38,13 +42,12 @@ Status BidiTracker::OnEvent(DevToolsClient* client,
     return Status(kOk);
   }
 
-  const base::Value* payloadVal = params.FindKey("payload");
-  if (payloadVal == nullptr) {
+  const std::string* payload = params.GetDict().FindString("payload");
+  if (payload == nullptr) {
     return Status(kUnknownError, "Runtime.bindingCalled missing 'payload'");
   }
 
-  std::string payload = payloadVal->GetString();
-  send_bidi_response_.Run(payload);
+  send_bidi_response_.Run(*payload);
 
   return Status(kOk);
 }
@@ -31,6 +31,7 @@ class BidiTracker : public DevToolsEventListener {
 
   // Overridden from DevToolsEventListener:
   bool ListensToConnections() const override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
                  const base::DictionaryValue& params) override;
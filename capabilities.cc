@@ -215,6 +215,19 @@ Status ParsePageLoadStrategy(const base::Value& option,
   return Status(kInvalidArgument, "invalid 'pageLoadStrategy'");
 }
 
+Status ParseBidiQueuePolicy(const base::Value& option,
+                            Capabilities* capabilities) {
+  if (!option.is_string())
+    return Status(kInvalidArgument, "must be a string");
+  // There is no blocking policy: the BiDiMapper cannot be paused, since its
+  // messages are fire-and-forget binding calls.
+  const std::string& policy = option.GetString();
+  if (policy != kBidiQueueDropOldest && policy != kBidiQueueDropNewest)
+    return Status(kInvalidArgument, "invalid 'bidiQueuePolicy'");
+  capabilities->bidi_queue_policy = policy;
+  return Status(kOk);
+}
+
 Status ParseUnhandledPromptBehavior(const base::Value& option,
                                     Capabilities* capabilities) {
   if (!option.is_string()) {
@@ -565,6 +578,17 @@ Status ParseChromeOptions(
   parser_map["devToolsEventsToLog"] =
       base::BindRepeating(&ParseDevToolsEventsLoggingPrefs);
   parser_map["windowTypes"] = base::BindRepeating(&ParseWindowTypes);
+  parser_map["bidiQueueCapacity"] =
+      base::BindRepeating(&ParseInterval, &capabilities->bidi_queue_capacity);
+  parser_map["bidiQueuePolicy"] = base::BindRepeating(&ParseBidiQueuePolicy);
+  parser_map["logStorageLimit"] =
+      base::BindRepeating(&ParseInterval, &capabilities->log_storage_limit);
+  parser_map["spillLogsToDisk"] =
+      base::BindRepeating(&ParseBoolean, &capabilities->spill_logs_to_disk);
+  parser_map["coalesceReads"] =
+      base::BindRepeating(&ParseBoolean, &capabilities->coalesce_reads);
+  parser_map["observeElementWaits"] =
+      base::BindRepeating(&ParseBoolean, &capabilities->observe_element_waits);
   // Compliance is read when session is initialized and correct response is
   // sent if not parsed correctly.
   parser_map["w3c"] = base::BindRepeating(&IgnoreCapability);
@@ -190,6 +190,25 @@ struct Capabilities {
   std::set<WebViewInfo::Type> window_types;
 
   bool webSocketUrl = false;
+
+  // Whether identical read-only commands, e.g. polls of the title or of the
+  // element visibility, that pile up while one of them runs share its result.
+  bool coalesce_reads = false;
+
+  // Whether implicit waits for elements wait on DOM mutations in the page
+  // instead of polling.
+  bool observe_element_waits = false;
+
+  // Number of BiDi messages kept while no BiDi connection is open, 0 for the
+  // session default, and what to do once they overflow, see kBidiQueue*.
+  int bidi_queue_capacity = 0;
+  std::string bidi_queue_policy;
+
+  // Bytes of memory each log may take, 0 for no limit, and whether the oldest
+  // entries over the limit are moved to the session temp dir instead of being
+  // dropped.
+  int log_storage_limit = 0;
+  bool spill_logs_to_disk = false;
 };
 
 bool GetChromeOptionsDictionary(const base::DictionaryValue& params,
@@ -375,6 +375,60 @@ TEST(ParseCapabilities, AcceptInsecureCertsDisabledByDefault) {
   ASSERT_FALSE(capabilities.accept_insecure_certs);
 }
 
+TEST(ParseCapabilities, CoalesceReads) {
+  Capabilities capabilities;
+  base::DictionaryValue caps;
+  Status status = capabilities.Parse(caps);
+  ASSERT_TRUE(status.IsOk());
+  ASSERT_FALSE(capabilities.coalesce_reads);
+
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.coalesceReads", true);
+  status = capabilities.Parse(caps);
+  ASSERT_TRUE(status.IsOk());
+  ASSERT_TRUE(capabilities.coalesce_reads);
+
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.coalesceReads", "yes");
+  status = capabilities.Parse(caps);
+  ASSERT_FALSE(status.IsOk());
+}
+
+TEST(ParseCapabilities, ObserveElementWaits) {
+  Capabilities capabilities;
+  base::DictionaryValue caps;
+  Status status = capabilities.Parse(caps);
+  ASSERT_TRUE(status.IsOk());
+  ASSERT_FALSE(capabilities.observe_element_waits);
+
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.observeElementWaits",
+                                 true);
+  status = capabilities.Parse(caps);
+  ASSERT_TRUE(status.IsOk());
+  ASSERT_TRUE(capabilities.observe_element_waits);
+}
+
+TEST(ParseCapabilities, BidiQueue) {
+  Capabilities capabilities;
+  base::DictionaryValue caps;
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.bidiQueueCapacity", 100);
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.bidiQueuePolicy",
+                                 "dropNewest");
+  Status status = capabilities.Parse(caps);
+  ASSERT_TRUE(status.IsOk());
+  ASSERT_EQ(100, capabilities.bidi_queue_capacity);
+  ASSERT_EQ("dropNewest", capabilities.bidi_queue_policy);
+
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.bidiQueuePolicy", "drop");
+  status = capabilities.Parse(caps);
+  ASSERT_FALSE(status.IsOk());
+  ASSERT_EQ("dropNewest", capabilities.bidi_queue_policy);
+
+  // The BiDiMapper cannot be blocked.
+  caps.GetDict().SetByDottedPath("goog:chromeOptions.bidiQueuePolicy", "block");
+  status = capabilities.Parse(caps);
+  ASSERT_FALSE(status.IsOk());
+  ASSERT_EQ("dropNewest", capabilities.bidi_queue_policy);
+}
+
 TEST(ParseCapabilities, EnableAcceptInsecureCerts) {
   Capabilities capabilities;
   base::DictionaryValue caps;
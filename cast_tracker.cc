@@ -21,6 +21,13 @@ bool CastTracker::ListensToConnections() const {
   return false;
 }
 
+base::flat_set<std::string> CastTracker::GetListenedEventMethods() const {
+  return {
+      "Cast.issueUpdated",
+      "Cast.sinksUpdated",
+  };
+}
+
 Status CastTracker::OnEvent(DevToolsClient* client,
                             const std::string& method,
                             const base::DictionaryValue& params) {
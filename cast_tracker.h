@@ -25,6 +25,7 @@ class CastTracker : public DevToolsEventListener {
 
   // DevToolsEventListener:
   bool ListensToConnections() const override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
                  const base::DictionaryValue& params) override;
@@ -0,0 +1,172 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "base/check_op.h"
+#include "base/lazy_instance.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/threading/thread_local.h"
+
+namespace {
+
+base::LazyInstance<base::ThreadLocalPointer<ScopedCdpCallRecorder>>::Leaky
+    lazy_tls_recorder = LAZY_INSTANCE_INITIALIZER;
+
+std::string BucketName(size_t index) {
+  if (index == LatencyHistogram::kBucketLimitsUs.size()) {
+    return ">=" +
+           base::NumberToString(LatencyHistogram::kBucketLimitsUs.back() /
+                                1000) +
+           "ms";
+  }
+  int64_t limit_us = LatencyHistogram::kBucketLimitsUs[index];
+  if (limit_us < 1000)
+    return "<" + base::NumberToString(limit_us) + "us";
+  return "<" + base::NumberToString(limit_us / 1000) + "ms";
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : buckets_{}, count_(0) {}
+
+LatencyHistogram::LatencyHistogram(const LatencyHistogram& other) = default;
+
+LatencyHistogram& LatencyHistogram::operator=(const LatencyHistogram& other) =
+    default;
+
+LatencyHistogram::~LatencyHistogram() = default;
+
+void LatencyHistogram::Add(base::TimeDelta latency) {
+  int64_t latency_us = latency.InMicroseconds();
+  size_t index = std::upper_bound(kBucketLimitsUs.begin(),
+                                  kBucketLimitsUs.end(), latency_us) -
+                 kBucketLimitsUs.begin();
+  ++buckets_[index];
+  ++count_;
+  total_ += latency;
+  max_ = std::max(max_, latency);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < kBucketCount; ++i)
+    buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  total_ += other.total_;
+  max_ = std::max(max_, other.max_);
+}
+
+int64_t LatencyHistogram::count() const {
+  return count_;
+}
+
+base::TimeDelta LatencyHistogram::total() const {
+  return total_;
+}
+
+base::TimeDelta LatencyHistogram::max() const {
+  return max_;
+}
+
+int64_t LatencyHistogram::bucket(size_t index) const {
+  return buckets_[index];
+}
+
+base::Value::Dict LatencyHistogram::ToValue() const {
+  base::Value::Dict buckets;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    if (buckets_[i])
+      buckets.Set(BucketName(i), static_cast<double>(buckets_[i]));
+  }
+  base::Value::Dict dict;
+  dict.Set("count", static_cast<double>(count_));
+  dict.Set("totalMs", total_.InMillisecondsF());
+  dict.Set("maxMs", max_.InMillisecondsF());
+  dict.Set("buckets", std::move(buckets));
+  return dict;
+}
+
+CdpMetrics::CdpMetrics() = default;
+
+CdpMetrics::CdpMetrics(const CdpMetrics& other) = default;
+
+CdpMetrics& CdpMetrics::operator=(const CdpMetrics& other) = default;
+
+CdpMetrics::~CdpMetrics() = default;
+
+void CdpMetrics::Merge(const CdpMetrics& other) {
+  bytes_sent += other.bytes_sent;
+  bytes_received += other.bytes_received;
+  parse_time.Merge(other.parse_time);
+  dispatch_time.Merge(other.dispatch_time);
+  for (const auto& [method, command] : other.commands) {
+    CommandMetrics& merged = commands[method];
+    merged.sent += command.sent;
+    merged.round_trip.Merge(command.round_trip);
+  }
+  for (const auto& [method, count] : other.events)
+    events[method] += count;
+}
+
+base::Value::Dict CdpMetrics::ToValue() const {
+  base::Value::Dict command_dict;
+  for (const auto& [method, command] : commands) {
+    base::Value::Dict dict;
+    dict.Set("sent", static_cast<double>(command.sent));
+    dict.Set("roundTrip", command.round_trip.ToValue());
+    command_dict.Set(method, std::move(dict));
+  }
+  base::Value::Dict event_dict;
+  for (const auto& [method, count] : events)
+    event_dict.Set(method, static_cast<double>(count));
+
+  base::Value::Dict dict;
+  dict.Set("bytesSent", static_cast<double>(bytes_sent));
+  dict.Set("bytesReceived", static_cast<double>(bytes_received));
+  dict.Set("parseTime", parse_time.ToValue());
+  dict.Set("dispatchTime", dispatch_time.ToValue());
+  dict.Set("commands", std::move(command_dict));
+  dict.Set("events", std::move(event_dict));
+  return dict;
+}
+
+ScopedCdpCallRecorder::ScopedCdpCallRecorder(bool record_calls)
+    : outer_(lazy_tls_recorder.Pointer()->Get()), record_calls_(record_calls) {
+  lazy_tls_recorder.Pointer()->Set(this);
+}
+
+ScopedCdpCallRecorder::~ScopedCdpCallRecorder() {
+  DCHECK_EQ(this, lazy_tls_recorder.Pointer()->Get());
+  lazy_tls_recorder.Pointer()->Set(outer_);
+}
+
+// static
+void ScopedCdpCallRecorder::RecordCall(const std::string& method,
+                                       base::TimeDelta round_trip) {
+  ScopedCdpCallRecorder* recorder = lazy_tls_recorder.Pointer()->Get();
+  if (!recorder || !recorder->record_calls_)
+    return;
+  recorder->calls_.push_back({method, round_trip});
+}
+
+// static
+void ScopedCdpCallRecorder::RecordBlockedTime(base::TimeDelta blocked_time) {
+  ScopedCdpCallRecorder* recorder = lazy_tls_recorder.Pointer()->Get();
+  if (recorder)
+    recorder->blocked_time_ += blocked_time;
+}
+
+base::Value::List ScopedCdpCallRecorder::CallsToValue() const {
+  base::Value::List list;
+  for (const Call& call : calls_) {
+    base::Value::Dict dict;
+    dict.Set("method", call.method);
+    dict.Set("roundTripMs", call.round_trip.InMillisecondsF());
+    list.Append(std::move(dict));
+  }
+  return list;
+}
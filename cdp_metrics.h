@@ -0,0 +1,120 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_TEST_CHROMEDRIVER_CHROME_CDP_METRICS_H_
+#define CHROME_TEST_CHROMEDRIVER_CHROME_CDP_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/memory/raw_ptr.h"
+#include "base/time/time.h"
+#include "base/values.h"
+
+// Distribution of durations in exponentially growing buckets.
+class LatencyHistogram {
+ public:
+  // Upper bounds (exclusive) of the buckets, in microseconds. The last bucket
+  // has no upper bound.
+  static constexpr std::array<int64_t, 9> kBucketLimitsUs = {
+      100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000};
+  static constexpr size_t kBucketCount = kBucketLimitsUs.size() + 1;
+
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram& other);
+  LatencyHistogram& operator=(const LatencyHistogram& other);
+  ~LatencyHistogram();
+
+  void Add(base::TimeDelta latency);
+  void Merge(const LatencyHistogram& other);
+
+  int64_t count() const;
+  base::TimeDelta total() const;
+  base::TimeDelta max() const;
+  int64_t bucket(size_t index) const;
+
+  // Returns {"count", "totalMs", "maxMs", "buckets"}, where "buckets" maps
+  // the upper bound of every non-empty bucket, e.g. "<5ms", to its count.
+  base::Value::Dict ToValue() const;
+
+ private:
+  std::array<int64_t, kBucketCount> buckets_;
+  int64_t count_;
+  base::TimeDelta total_;
+  base::TimeDelta max_;
+};
+
+// Wire-level statistics of a DevTools client.
+struct CdpMetrics {
+  struct CommandMetrics {
+    int64_t sent = 0;
+    // Time between sending the command and receiving its response.
+    LatencyHistogram round_trip;
+  };
+
+  CdpMetrics();
+  CdpMetrics(const CdpMetrics& other);
+  CdpMetrics& operator=(const CdpMetrics& other);
+  ~CdpMetrics();
+
+  void Merge(const CdpMetrics& other);
+  base::Value::Dict ToValue() const;
+
+  int64_t bytes_sent = 0;
+  int64_t bytes_received = 0;
+  // Time spent parsing the received messages.
+  LatencyHistogram parse_time;
+  // Time spent in the listeners, including any nested message processing.
+  LatencyHistogram dispatch_time;
+  // Keyed by the DevTools method.
+  std::map<std::string, CommandMetrics> commands;
+  std::map<std::string, int64_t> events;
+};
+
+// Records how long the current thread is blocked on DevTools during its
+// lifetime and, optionally, the commands that get their response meanwhile.
+// When recorders are nested, only the innermost one records.
+class ScopedCdpCallRecorder {
+ public:
+  struct Call {
+    std::string method;
+    base::TimeDelta round_trip;
+  };
+
+  // The commands are only recorded if |record_calls| is true.
+  explicit ScopedCdpCallRecorder(bool record_calls = true);
+  ScopedCdpCallRecorder(const ScopedCdpCallRecorder&) = delete;
+  ScopedCdpCallRecorder& operator=(const ScopedCdpCallRecorder&) = delete;
+  ~ScopedCdpCallRecorder();
+
+  // Called by the DevTools clients for every command response. Does nothing
+  // if there is no recorder on the current thread.
+  static void RecordCall(const std::string& method,
+                         base::TimeDelta round_trip);
+  // Called by the DevTools clients after waiting for a message from the
+  // browser. Does nothing if there is no recorder on the current thread.
+  static void RecordBlockedTime(base::TimeDelta blocked_time);
+
+  const std::vector<Call>& calls() const { return calls_; }
+  // Time spent waiting for messages from the browser. Unlike the sum of the
+  // round trips, it does not count the commands that overlap or that nobody
+  // waits for twice.
+  base::TimeDelta blocked_time() const { return blocked_time_; }
+
+  // Returns [{"method", "roundTripMs"}] in the order of the responses.
+  base::Value::List CallsToValue() const;
+
+ private:
+  raw_ptr<ScopedCdpCallRecorder> outer_;
+  const bool record_calls_;
+  std::vector<Call> calls_;
+  base::TimeDelta blocked_time_;
+};
+
+#endif  // CHROME_TEST_CHROMEDRIVER_CHROME_CDP_METRICS_H_
@@ -0,0 +1,106 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
+
+#include "base/time/time.h"
+#include "base/values.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+TEST(LatencyHistogramTest, Buckets) {
+  LatencyHistogram histogram;
+  histogram.Add(base::Microseconds(99));
+  histogram.Add(base::Microseconds(100));
+  histogram.Add(base::Milliseconds(3));
+  histogram.Add(base::Seconds(2));
+  EXPECT_EQ(4, histogram.count());
+  EXPECT_EQ(1, histogram.bucket(0));
+  EXPECT_EQ(1, histogram.bucket(1));
+  EXPECT_EQ(1, histogram.bucket(3));
+  EXPECT_EQ(1, histogram.bucket(LatencyHistogram::kBucketCount - 1));
+  EXPECT_EQ(base::Seconds(2), histogram.max());
+
+  base::Value::Dict value = histogram.ToValue();
+  EXPECT_EQ(4, value.FindDouble("count").value_or(-1));
+  const base::Value::Dict* buckets = value.FindDict("buckets");
+  ASSERT_TRUE(buckets);
+  EXPECT_EQ(4u, buckets->size());
+  EXPECT_EQ(1, buckets->FindDouble("<100us").value_or(-1));
+  EXPECT_EQ(1, buckets->FindDouble("<5ms").value_or(-1));
+  EXPECT_EQ(1, buckets->FindDouble(">=1000ms").value_or(-1));
+}
+
+TEST(LatencyHistogramTest, Merge) {
+  LatencyHistogram first;
+  first.Add(base::Milliseconds(1));
+  LatencyHistogram second;
+  second.Add(base::Milliseconds(7));
+  second.Add(base::Milliseconds(2));
+  first.Merge(second);
+  EXPECT_EQ(3, first.count());
+  EXPECT_EQ(base::Milliseconds(10), first.total());
+  EXPECT_EQ(base::Milliseconds(7), first.max());
+}
+
+TEST(CdpMetricsTest, Merge) {
+  CdpMetrics first;
+  first.bytes_sent = 10;
+  first.commands["Page.navigate"].sent = 1;
+  first.events["Page.loadEventFired"] = 2;
+  CdpMetrics second;
+  second.bytes_sent = 5;
+  second.bytes_received = 7;
+  second.commands["Page.navigate"].sent = 2;
+  second.commands["Page.navigate"].round_trip.Add(base::Milliseconds(4));
+  second.events["Page.loadEventFired"] = 1;
+  first.Merge(second);
+  EXPECT_EQ(15, first.bytes_sent);
+  EXPECT_EQ(7, first.bytes_received);
+  EXPECT_EQ(3, first.commands["Page.navigate"].sent);
+  EXPECT_EQ(1, first.commands["Page.navigate"].round_trip.count());
+  EXPECT_EQ(3, first.events["Page.loadEventFired"]);
+
+  base::Value::Dict value = first.ToValue();
+  EXPECT_EQ(15, value.FindDouble("bytesSent").value_or(-1));
+  const base::Value::Dict* commands = value.FindDict("commands");
+  ASSERT_TRUE(commands);
+  const base::Value::Dict* navigate = commands->FindDict("Page.navigate");
+  ASSERT_TRUE(navigate);
+  EXPECT_EQ(3, navigate->FindDouble("sent").value_or(-1));
+}
+
+TEST(ScopedCdpCallRecorderTest, RecordsIntoInnermostRecorder) {
+  // Without a recorder the calls are dropped.
+  ScopedCdpCallRecorder::RecordCall("Runtime.evaluate", base::Milliseconds(1));
+
+  ScopedCdpCallRecorder outer;
+  ScopedCdpCallRecorder::RecordCall("Page.navigate", base::Milliseconds(2));
+  {
+    ScopedCdpCallRecorder inner;
+    ScopedCdpCallRecorder::RecordCall("DOM.getDocument", base::Milliseconds(3));
+    ScopedCdpCallRecorder::RecordCall("DOM.focus", base::Milliseconds(4));
+    ScopedCdpCallRecorder::RecordBlockedTime(base::Milliseconds(6));
+    ASSERT_EQ(2u, inner.calls().size());
+    EXPECT_EQ("DOM.getDocument", inner.calls()[0].method);
+    EXPECT_EQ(base::Milliseconds(6), inner.blocked_time());
+  }
+  ScopedCdpCallRecorder::RecordCall("Page.reload", base::Milliseconds(5));
+  ScopedCdpCallRecorder::RecordBlockedTime(base::Milliseconds(1));
+  ASSERT_EQ(2u, outer.calls().size());
+  EXPECT_EQ(base::Milliseconds(1), outer.blocked_time());
+
+  base::Value::List calls = outer.CallsToValue();
+  ASSERT_EQ(2u, calls.size());
+  ASSERT_TRUE(calls[1].is_dict());
+  EXPECT_EQ("Page.reload", *calls[1].GetDict().FindString("method"));
+  EXPECT_EQ(5, calls[1].GetDict().FindDouble("roundTripMs").value_or(-1));
+}
+
+TEST(ScopedCdpCallRecorderTest, OnlyRecordsCallsIfRequested) {
+  ScopedCdpCallRecorder recorder(false);
+  ScopedCdpCallRecorder::RecordCall("Page.navigate", base::Milliseconds(2));
+  ScopedCdpCallRecorder::RecordBlockedTime(base::Milliseconds(2));
+  EXPECT_TRUE(recorder.calls().empty());
+  EXPECT_EQ(base::Milliseconds(2), recorder.blocked_time());
+}
@@ -9,11 +9,7 @@
 #include <string>
 
 #include "base/callback_forward.h"
-
-namespace base {
-class DictionaryValue;
-class Value;
-}
+#include "base/values.h"
 
 class Status;
 
@@ -21,9 +17,18 @@ typedef base::RepeatingCallback<
     void(const Status&, std::unique_ptr<base::Value>, const std::string&, bool)>
     CommandCallback;
 
+// The parameters are passed by value so that the parsed request body can be
+// moved all the way to the session thread without being copied.
+typedef base::RepeatingCallback<
+    void(base::Value::Dict, const std::string&, const CommandCallback&)>
+    Command;
+
+// Signature that Command had before it took the parameters by value. Some
+// commands implemented by the HTTP handler still use it. To bind them as a
+// Command, adapt them with AdaptCommandWithParamsByReference().
 typedef base::RepeatingCallback<void(const base::DictionaryValue&,
                                      const std::string&,
                                      const CommandCallback&)>
-    Command;
+    CommandWithParamsByReference;
 
 #endif  // CHROME_TEST_CHROMEDRIVER_COMMAND_H_
@@ -8,25 +8,41 @@
 
 #include <algorithm>
 #include <list>
+#include <map>
+#include <memory>
+#include <set>
 #include <utility>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/callback_helpers.h"
 #include "base/containers/contains.h"
 #include "base/location.h"
+#include "base/json/json_writer.h"
+#include "base/lazy_instance.h"
 #include "base/logging.h"
 #include "base/memory/ptr_util.h"
-#include "base/run_loop.h"
+#include "base/memory/ref_counted.h"
+#include "base/no_destructor.h"
+#include "base/strings/str_cat.h"
+#include "base/strings/string_piece.h"
 #include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
 #include "base/system/sys_info.h"
 #include "base/task/current_thread.h"
 #include "base/task/single_thread_task_runner.h"
+#include "base/thread_annotations.h"
+#include "base/threading/platform_thread.h"
 #include "base/threading/thread_task_runner_handle.h"
+#include "base/time/time.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/capabilities.h"
 #include "chrome/test/chromedriver/chrome/browser_info.h"
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
 #include "chrome/test/chromedriver/chrome/chrome.h"
+#include "chrome/test/chromedriver/chrome/navigation_tracker.h"
 #include "chrome/test/chromedriver/chrome/status.h"
+#include "chrome/test/chromedriver/chrome/web_view.h"
 #include "chrome/test/chromedriver/constants/version.h"
 #include "chrome/test/chromedriver/logging.h"
 #include "chrome/test/chromedriver/session.h"
@@ -34,8 +50,39 @@
 #include "chrome/test/chromedriver/session_thread_map.h"
 #include "chrome/test/chromedriver/util.h"
 
+namespace {
+
+// Command latencies of all the sessions, keyed by the command name. Updated
+// on the session threads.
+struct GlobalCommandLatencies {
+  base::Lock lock;
+  std::map<std::string, CommandLatencyMetrics> latencies GUARDED_BY(lock);
+};
+
+GlobalCommandLatencies& GetGlobalCommandLatencies() {
+  static base::NoDestructor<GlobalCommandLatencies> global_latencies;
+  return *global_latencies;
+}
+
+void RunCommandWithParamsByReference(
+    const CommandWithParamsByReference& command,
+    base::Value::Dict params,
+    const std::string& session_id,
+    const CommandCallback& callback) {
+  base::Value params_value(std::move(params));
+  command.Run(base::Value::AsDictionaryValue(params_value), session_id,
+              callback);
+}
+
+}  // namespace
+
+Command AdaptCommandWithParamsByReference(
+    const CommandWithParamsByReference& command) {
+  return base::BindRepeating(&RunCommandWithParamsByReference, command);
+}
+
 void ExecuteGetStatus(
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback) {
   // W3C defined data:
@@ -58,146 +105,338 @@ void ExecuteGetStatus(
   os.GetDict().Set("arch", base::SysInfo::OperatingSystemArchitecture());
   info.SetKey("os", std::move(os));
 
+  base::Value::Dict latencies;
+  {
+    GlobalCommandLatencies& global_latencies = GetGlobalCommandLatencies();
+    base::AutoLock lock(global_latencies.lock);
+    for (const auto& [command_name, metrics] : global_latencies.latencies)
+      latencies.Set(command_name, metrics.ToValue());
+  }
+  info.GetDict().Set("commandLatencies", std::move(latencies));
+
   callback.Run(Status(kOk), base::Value::ToUniquePtrValue(std::move(info)),
                std::string(), kW3CDefault);
 }
 
+namespace {
+
+// Maximum number of threads of terminated sessions kept for reuse.
+const size_t kMaxIdleSessionThreads = 16;
+
+// Whether the threads of terminated sessions are kept for reuse. Only
+// accessed on the command thread.
+bool g_reuse_session_threads = true;
+
+// Running threads of terminated sessions. Starting and joining a thread per
+// session is costly when many short sessions are created. Session commands
+// block their thread, e.g. while waiting for the browser, therefore every
+// session still owns a dedicated thread while it exists.
+// Only accessed on the command thread. The AtExitManager stops and joins the
+// threads still kept when ChromeDriver exits.
+base::LazyInstance<std::vector<std::unique_ptr<base::Thread>>>::DestructorAtExit
+    g_idle_session_threads = LAZY_INSTANCE_INITIALIZER;
+
+std::vector<std::unique_ptr<base::Thread>>& GetIdleSessionThreads() {
+  return g_idle_session_threads.Get();
+}
+
+// Returns a running thread for a new session, or nullptr on failure.
+std::unique_ptr<base::Thread> AcquireSessionThread(const std::string& name) {
+  std::vector<std::unique_ptr<base::Thread>>& idle_threads =
+      GetIdleSessionThreads();
+  if (!idle_threads.empty()) {
+    std::unique_ptr<base::Thread> thread = std::move(idle_threads.back());
+    idle_threads.pop_back();
+    // The thread is still named after the session it last served.
+    thread->task_runner()->PostTask(
+        FROM_HERE, base::BindOnce(&base::PlatformThread::SetName, name));
+    return thread;
+  }
+  auto thread = std::make_unique<base::Thread>(name);
+  if (!thread->Start())
+    return nullptr;
+  return thread;
+}
+
+void ReleaseSessionThread(std::unique_ptr<base::Thread> thread) {
+  std::vector<std::unique_ptr<base::Thread>>& idle_threads =
+      GetIdleSessionThreads();
+  if (g_reuse_session_threads && thread && thread->IsRunning() &&
+      idle_threads.size() < kMaxIdleSessionThreads) {
+    idle_threads.push_back(std::move(thread));
+  }
+  // Otherwise |thread| is stopped and joined on destruction.
+}
+
+}  // namespace
+
+void ShutdownIdleSessionThreads() {
+  // Each thread is stopped and joined on destruction.
+  GetIdleSessionThreads().clear();
+}
+
+void SetSessionThreadReuse(bool enabled) {
+  g_reuse_session_threads = enabled;
+  if (!enabled)
+    ShutdownIdleSessionThreads();
+}
+
 void ExecuteCreateSession(SessionThreadMap* session_thread_map,
                           const Command& init_session_cmd,
-                          const base::DictionaryValue& params,
+                          base::Value::Dict params,
                           const std::string& host,
                           const CommandCallback& callback) {
   std::string new_id = GenerateId();
   std::unique_ptr<Session> session = std::make_unique<Session>(new_id, host);
-  std::unique_ptr<SessionThreadInfo> threadInfo =
-      std::make_unique<SessionThreadInfo>(new_id, GetW3CSetting(params));
-  if (!threadInfo->thread()->Start()) {
+  std::unique_ptr<base::Thread> thread = AcquireSessionThread(new_id);
+  if (!thread) {
     callback.Run(
         Status(kUnknownError, "failed to start a thread for the new session"),
         std::unique_ptr<base::Value>(), std::string(),
         session->w3c_compliant);
     return;
   }
+  base::Value params_value(std::move(params));
+  std::unique_ptr<SessionThreadInfo> threadInfo =
+      std::make_unique<SessionThreadInfo>(
+          std::move(thread),
+          GetW3CSetting(base::Value::AsDictionaryValue(params_value)));
 
   threadInfo->thread()->task_runner()->PostTask(
       FROM_HERE, base::BindOnce(&SetThreadLocalSession, std::move(session)));
   session_thread_map->insert(std::make_pair(new_id, std::move(threadInfo)));
-  init_session_cmd.Run(params, new_id, callback);
+  init_session_cmd.Run(std::move(params_value.GetDict()), new_id, callback);
 }
 
 namespace {
 
-void OnGetSession(const base::WeakPtr<size_t>& session_remaining_count,
-                  const base::RepeatingClosure& all_get_session_func,
-                  base::ListValue* session_list,
-                  const Status& status,
+// How long each session has to respond to a command sent to all the sessions.
+constexpr base::TimeDelta kFanOutSessionTimeout = base::Seconds(10);
+
+// Sends a command to all the sessions and collects their responses on the
+// command thread, which keeps serving other requests meanwhile. The sessions
+// execute the command in parallel on their own threads. |on_done| runs once
+// every session has either responded or timed out.
+class SessionFanOut : public base::RefCounted<SessionFanOut> {
+ public:
+  // Receives the values returned by the sessions and the errors of the
+  // sessions that failed or timed out, both keyed by session id.
+  using DoneCallback =
+      base::OnceCallback<void(base::Value::Dict responses,
+                              base::Value::Dict errors)>;
+
+  static void Start(const Command& command,
+                    SessionThreadMap* session_thread_map,
+                    const base::Value::Dict& params,
+                    DoneCallback on_done) {
+    std::set<std::string> session_ids;
+    for (const auto& entry : *session_thread_map)
+      session_ids.insert(entry.first);
+    scoped_refptr<SessionFanOut> fan_out = base::WrapRefCounted(
+        new SessionFanOut(session_ids, std::move(on_done)));
+    fan_out->MaybeFinish();
+    for (const std::string& session_id : session_ids) {
+      base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(
+          FROM_HERE,
+          base::BindOnce(&SessionFanOut::OnTimeout, fan_out, session_id),
+          kFanOutSessionTimeout);
+      command.Run(params.Clone(), session_id,
+                  base::BindRepeating(&SessionFanOut::OnResponse, fan_out));
+    }
+  }
+
+ private:
+  friend class base::RefCounted<SessionFanOut>;
+
+  SessionFanOut(std::set<std::string> pending, DoneCallback on_done)
+      : pending_(std::move(pending)), on_done_(std::move(on_done)) {}
+  ~SessionFanOut() = default;
+
+  void OnResponse(const Status& status,
                   std::unique_ptr<base::Value> value,
                   const std::string& session_id,
                   bool w3c_compliant) {
-  if (!session_remaining_count)
-    return;
+    // The session may have already timed out.
+    if (!pending_.erase(session_id))
+      return;
+    if (status.IsError())
+      errors_.Set(session_id, status.message());
+    else if (value)
+      responses_.Set(session_id,
+                     base::Value::FromUniquePtrValue(std::move(value)));
+    MaybeFinish();
+  }
 
-  (*session_remaining_count)--;
+  void OnTimeout(const std::string& session_id) {
+    if (!pending_.erase(session_id))
+      return;
+    errors_.Set(session_id, "timed out waiting for the session to respond");
+    MaybeFinish();
+  }
 
-  if (value) {
-    base::Value::Dict session;
-    session.Set("id", session_id);
-    session.Set("capabilities",
-                base::Value::FromUniquePtrValue(std::move(value)));
-    session_list->GetList().Append(std::move(session));
+  void MaybeFinish() {
+    if (pending_.empty() && on_done_)
+      std::move(on_done_).Run(std::move(responses_), std::move(errors_));
   }
 
-  if (!*session_remaining_count) {
-    all_get_session_func.Run();
+  std::set<std::string> pending_;
+  base::Value::Dict responses_;
+  base::Value::Dict errors_;
+  DoneCallback on_done_;
+};
+
+void LogFanOutErrors(const char* command_name,
+                     const base::Value::Dict& errors) {
+  for (const auto item : errors) {
+    LOG(WARNING) << command_name << " failed for session " << item.first
+                 << ": " << item.second.GetString();
   }
 }
 
+void OnGetSessionsDone(const std::string& session_id,
+                       const CommandCallback& callback,
+                       base::Value::Dict responses,
+                       base::Value::Dict errors) {
+  LogFanOutErrors("GetSessions", errors);
+  base::Value::List session_list;
+  for (auto item : responses) {
+    base::Value::Dict session;
+    session.Set("id", item.first);
+    session.Set("capabilities", std::move(item.second));
+    session_list.Append(std::move(session));
+  }
+  callback.Run(Status(kOk),
+               std::make_unique<base::Value>(std::move(session_list)),
+               session_id, false);
+}
+
+void OnQuitAllDone(const std::string& session_id,
+                   const CommandCallback& callback,
+                   base::Value::Dict responses,
+                   base::Value::Dict errors) {
+  LogFanOutErrors("Quit", errors);
+  // Reports the sessions that could not be quit, if any.
+  std::unique_ptr<base::Value> value;
+  if (!errors.empty())
+    value = std::make_unique<base::Value>(std::move(errors));
+  callback.Run(Status(kOk), std::move(value), session_id, false);
+}
+
 }  // namespace
 
 void ExecuteGetSessions(const Command& session_capabilities_command,
                         SessionThreadMap* session_thread_map,
-                        const base::DictionaryValue& params,
+                        base::Value::Dict params,
                         const std::string& session_id,
                         const CommandCallback& callback) {
-  size_t get_remaining_count = session_thread_map->size();
-  base::WeakPtrFactory<size_t> weak_ptr_factory(&get_remaining_count);
-  std::unique_ptr<base::ListValue> session_list(new base::ListValue());
-
-  if (!get_remaining_count) {
-    callback.Run(Status(kOk), std::move(session_list), session_id, false);
-    return;
-  }
-
-  base::RunLoop run_loop(base::RunLoop::Type::kNestableTasksAllowed);
-
-  for (auto iter = session_thread_map->begin();
-       iter != session_thread_map->end(); ++iter) {
-    session_capabilities_command.Run(
-        params, iter->first,
-        base::BindRepeating(&OnGetSession, weak_ptr_factory.GetWeakPtr(),
-                            run_loop.QuitClosure(), session_list.get()));
-  }
-  base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(
-      FROM_HERE, run_loop.QuitClosure(), base::Seconds(10));
-  run_loop.Run();
-
-  callback.Run(Status(kOk), std::move(session_list), session_id, false);
+  SessionFanOut::Start(
+      session_capabilities_command, session_thread_map, params,
+      base::BindOnce(&OnGetSessionsDone, session_id, callback));
 }
 
-namespace {
-
-void OnSessionQuit(const base::WeakPtr<size_t>& quit_remaining_count,
-                   const base::RepeatingClosure& all_quit_func,
-                   const Status& status,
-                   std::unique_ptr<base::Value> value,
-                   const std::string& session_id,
-                   bool w3c_compliant) {
-  // |quit_remaining_count| may no longer be valid if a timeout occurred.
-  if (!quit_remaining_count)
-    return;
-
-  (*quit_remaining_count)--;
-  if (!*quit_remaining_count)
-    all_quit_func.Run();
-}
-
-}  // namespace
-
 void ExecuteQuitAll(
     const Command& quit_command,
     SessionThreadMap* session_thread_map,
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback) {
-  size_t quit_remaining_count = session_thread_map->size();
-  base::WeakPtrFactory<size_t> weak_ptr_factory(&quit_remaining_count);
-  if (!quit_remaining_count) {
-    callback.Run(Status(kOk), std::unique_ptr<base::Value>(),
-                 session_id, false);
-    return;
-  }
-  base::RunLoop run_loop(base::RunLoop::Type::kNestableTasksAllowed);
-  for (auto iter = session_thread_map->begin();
-       iter != session_thread_map->end(); ++iter) {
-    quit_command.Run(
-        params, iter->first,
-        base::BindRepeating(&OnSessionQuit, weak_ptr_factory.GetWeakPtr(),
-                            run_loop.QuitClosure()));
-  }
-  base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(
-      FROM_HERE, run_loop.QuitClosure(), base::Seconds(10));
-  // Uses a nested run loop to block this thread until all the quit
-  // commands have executed, or the timeout expires.
-  run_loop.Run();
-  callback.Run(Status(kOk), std::unique_ptr<base::Value>(),
-               session_id, false);
+  SessionFanOut::Start(quit_command, session_thread_map, params,
+                       base::BindOnce(&OnQuitAllDone, session_id, callback));
 }
 
 namespace {
 
 void TerminateSessionThreadOnCommandThread(SessionThreadMap* session_thread_map,
                                            const std::string& session_id) {
-  session_thread_map->erase(session_id);
+  auto iter = session_thread_map->find(session_id);
+  if (iter == session_thread_map->end())
+    return;
+  // The session has already been deleted on its thread, which can therefore
+  // serve another session.
+  std::unique_ptr<base::Thread> thread = iter->second->ReleaseThread();
+  session_thread_map->erase(iter);
+  ReleaseSessionThread(std::move(thread));
+}
+
+void RecordCommandLatency(Session* session,
+                          const char* command_name,
+                          base::TimeDelta queueing_time,
+                          base::TimeDelta execution_time,
+                          const ScopedCdpCallRecorder& cdp_calls,
+                          const ScopedNavigationCommand& navigation_command) {
+  CommandLatencyMetrics latency;
+  latency.queueing.Add(queueing_time);
+  latency.execution.Add(execution_time);
+  latency.devtools_wait.Add(cdp_calls.blocked_time());
+  latency.skipped_navigation_checks = navigation_command.skipped_round_trips();
+  session->command_latencies[command_name].Merge(latency);
+  {
+    GlobalCommandLatencies& global_latencies = GetGlobalCommandLatencies();
+    base::AutoLock lock(global_latencies.lock);
+    global_latencies.latencies[command_name].Merge(latency);
+  }
+
+  base::TimeDelta threshold = GetSlowCommandThreshold();
+  if (threshold.is_zero() || queueing_time + execution_time < threshold)
+    return;
+  base::Value::Dict breakdown;
+  breakdown.Set("queueingMs", queueing_time.InMillisecondsF());
+  breakdown.Set("executionMs", execution_time.InMillisecondsF());
+  breakdown.Set("devtoolsWaitMs", cdp_calls.blocked_time().InMillisecondsF());
+  breakdown.Set("devtoolsCalls", cdp_calls.CallsToValue());
+  LOG(WARNING) << "[" << session->id << "] "
+               << "SLOW COMMAND " << command_name << " "
+               << PrettyPrintValue(base::Value(std::move(breakdown)));
+}
+
+// Commands, as named by the HTTP handler, that only inspect the page and
+// therefore cannot start a navigation. All other commands are treated as
+// possibly navigating.
+const char* const kNonNavigatingCommands[] = {
+    "FindChildElement",
+    "FindChildElements",
+    "FindElement",
+    "FindElements",
+    "GetActiveElement",
+    "GetElementAttribute",
+    "GetElementProperty",
+    "GetElementRect",
+    "GetElementTagName",
+    "GetElementText",
+    "GetPageSource",
+    "GetTitle",
+    "GetUrl",
+    "IsElementDisplayed",
+    "IsElementEnabled",
+    "IsElementSelected",
+    "QueryElements",
+};
+
+// Read-only commands that tests tend to poll, as named by the HTTP handler.
+const char* const kCoalescableCommands[] = {"GetTitle", "GetUrl", "GetWindows",
+                                            "IsElementDisplayed"};
+
+// Returns the key of the result of the command in Session::coalesced_reads,
+// or an empty string if the result must not be shared.
+std::string GetCoalescedReadKey(Session* session,
+                                const char* command_name,
+                                const base::DictionaryValue& params) {
+  if (!session->coalesce_reads ||
+      !base::Contains(kCoalescableCommands, base::StringPiece(command_name))) {
+    return std::string();
+  }
+  std::string params_json;
+  base::JSONWriter::Write(params, &params_json);
+  return base::StrCat({command_name, " ", session->window, " ",
+                       session->GetCurrentFrameId(), " ", params_json});
+}
+
+// Processes the events already received for the target window, so that page
+// changes invalidate the coalesced reads before one is reused.
+void HandleTargetWindowEvents(Session* session) {
+  WebView* web_view = nullptr;
+  if (session->GetTargetWindow(&web_view).IsOk())
+    web_view->HandleReceivedEvents();
 }
 
 void ExecuteSessionCommandOnSessionThread(
@@ -207,9 +446,11 @@ void ExecuteSessionCommandOnSessionThread(
     bool w3c_standard_command,
     bool return_ok_without_session,
     std::unique_ptr<base::DictionaryValue> params,
+    base::TimeTicks queued_time,
     scoped_refptr<base::SingleThreadTaskRunner> cmd_task_runner,
     const CommandCallback& callback_on_cmd,
     const base::RepeatingClosure& terminate_on_cmd) {
+  base::TimeDelta queueing_time = base::TimeTicks::Now() - queued_time;
   Session* session = GetThreadLocalSession();
 
   if (!session) {
@@ -259,7 +500,39 @@ void ExecuteSessionCommandOnSessionThread(
     if (status.IsError()) {
       LOG(ERROR) << status.message();
     } else {
-      status = command.Run(session, *params, &value);
+      std::string read_key =
+          GetCoalescedReadKey(session, command_name, *params);
+      if (!read_key.empty()) {
+        HandleTargetWindowEvents(session);
+      } else if (session->coalesce_reads) {
+        session->InvalidateCoalescedReads();
+      }
+      // Only the commands queued while the read was running share its result.
+      // The page may change without any event, e.g. when a script updates the
+      // DOM, so a later poll reads again.
+      auto cached_read = session->coalesced_reads.find(read_key);
+      if (!read_key.empty() && cached_read != session->coalesced_reads.end() &&
+          queued_time < cached_read->second.completion_time) {
+        value =
+            base::Value::ToUniquePtrValue(cached_read->second.value.Clone());
+      } else {
+        int generation = session->coalesced_reads_generation;
+        // The calls are only reported for slow commands.
+        ScopedCdpCallRecorder cdp_calls(!GetSlowCommandThreshold().is_zero());
+        ScopedNavigationCommand navigation_command(!base::Contains(
+            kNonNavigatingCommands, base::StringPiece(command_name)));
+        base::TimeTicks start_time = base::TimeTicks::Now();
+        status = command.Run(session, *params, &value);
+        RecordCommandLatency(session, command_name, queueing_time,
+                             base::TimeTicks::Now() - start_time, cdp_calls,
+                             navigation_command);
+        // The result is only shared if the page did not change meanwhile.
+        if (!read_key.empty() && status.IsOk() && value &&
+            generation == session->coalesced_reads_generation) {
+          session->coalesced_reads.insert_or_assign(
+              read_key, CoalescedRead(value->Clone(), base::TimeTicks::Now()));
+        }
+      }
 
       if (status.IsError() && session->chrome) {
         if (!session->quit && session->chrome->HasCrashedWebView()) {
@@ -332,7 +605,7 @@ void ExecuteSessionCommand(SessionThreadMap* session_thread_map,
                            const SessionCommand& command,
                            bool w3c_standard_command,
                            bool return_ok_without_session,
-                           const base::DictionaryValue& params,
+                           base::Value::Dict params,
                            const std::string& session_id,
                            const CommandCallback& callback) {
   auto iter = session_thread_map->find(session_id);
@@ -347,8 +620,9 @@ void ExecuteSessionCommand(SessionThreadMap* session_thread_map,
             &ExecuteSessionCommandOnSessionThread, command_name, session_id,
             command, w3c_standard_command, return_ok_without_session,
             base::DictionaryValue::From(
-                base::Value::ToUniquePtrValue(params.Clone())),
-            base::ThreadTaskRunnerHandle::Get(), callback,
+                std::make_unique<base::Value>(std::move(params))),
+            base::TimeTicks::Now(), base::ThreadTaskRunnerHandle::Get(),
+            callback,
             base::BindRepeating(&TerminateSessionThreadOnCommandThread,
                                 session_thread_map, session_id)));
   }
@@ -360,4 +634,8 @@ void CreateSessionOnSessionThreadForTesting(const std::string& id) {
   SetThreadLocalSession(std::make_unique<Session>(id));
 }
 
+size_t GetIdleSessionThreadCountForTesting() {
+  return GetIdleSessionThreads().size();
+}
+
 }  // namespace internal
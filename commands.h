@@ -5,6 +5,8 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_COMMANDS_H_
 #define CHROME_TEST_CHROMEDRIVER_COMMANDS_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <string>
 
@@ -21,32 +23,50 @@ class Value;
 struct Session;
 class Status;
 
+// Adapts |command| to Command without copying the parameters.
+Command AdaptCommandWithParamsByReference(
+    const CommandWithParamsByReference& command);
+
 // Gets status/info about ChromeDriver.
 void ExecuteGetStatus(
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback);
 
 // Creates a new session.
 void ExecuteCreateSession(SessionThreadMap* session_thread_map,
                           const Command& init_session_cmd,
-                          const base::DictionaryValue& params,
+                          base::Value::Dict params,
                           const std::string& host,
                           const CommandCallback& callback);
 
-// Gets all sessions
+// Stops and joins the threads that terminated sessions left for reuse. The
+// AtExitManager also does it when ChromeDriver exits. Call on the command
+// thread.
+void ShutdownIdleSessionThreads();
+
+// Enables or disables keeping the threads of terminated sessions for reuse,
+// which is enabled by default. Disabling it also shuts down the idle threads.
+// Call on the command thread.
+void SetSessionThreadReuse(bool enabled);
+
+// Gets all sessions. Runs |callback| once every session has responded or
+// timed out, without blocking the command thread meanwhile.
 void ExecuteGetSessions(
     const Command& session_capabilities_command,
     SessionThreadMap* session_thread_map,
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback);
 
-// Quits all sessions.
+// Quits all sessions in parallel. Runs |callback| once every session has quit
+// or timed out, with a dictionary of the errors keyed by session id if any
+// session failed to quit. To exit once all sessions have quit, exit from
+// |callback| instead of waiting on the command thread.
 void ExecuteQuitAll(
     const Command& quit_command,
     SessionThreadMap* session_thread_map,
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback);
 
@@ -56,18 +76,20 @@ typedef base::RepeatingCallback<Status(Session* session,
     SessionCommand;
 
 // Executes a given session command, after acquiring access to the appropriate
-// session.
+// session. |params| are moved to the session thread.
 void ExecuteSessionCommand(SessionThreadMap* session_thread_map,
                            const char* command_name,
                            const SessionCommand& command,
                            bool w3c_standard_command,
                            bool return_ok_without_session,
-                           const base::DictionaryValue& params,
+                           base::Value::Dict params,
                            const std::string& session_id,
                            const CommandCallback& callback);
 
 namespace internal {
 void CreateSessionOnSessionThreadForTesting(const std::string& id);
+// Returns the number of threads kept for reuse by the next sessions.
+size_t GetIdleSessionThreadCountForTesting();
 }  // namespace internal
 
 #endif  // CHROME_TEST_CHROMEDRIVER_COMMANDS_H_
@@ -0,0 +1,499 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Stress benchmark driving many concurrent sessions in-process against stub
+// browsers. It exercises the command thread, the session threads and the
+// command plumbing without a real browser, e.g.:
+//   chromedriver_stress --sessions=50 --commands=2000 \
+//       --mix=getTimeouts:4,getWindowHandles:1,devtoolsCommand:1 \
+//       --browser-latency-ms=2
+// Session start-up, e.g. with and without reusing session threads:
+//   chromedriver_stress --sessions=200 --commands=10 --rounds=5
+//   chromedriver_stress --sessions=200 --commands=10 --rounds=5 \
+//       --no-thread-reuse
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/at_exit.h"
+#include "base/bind.h"
+#include "base/command_line.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/rand_util.h"
+#include "base/run_loop.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
+#include "base/task/single_thread_task_executor.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "base/time/time.h"
+#include "base/values.h"
+#include "build/build_config.h"
+#include "chrome/test/chromedriver/chrome/status.h"
+#include "chrome/test/chromedriver/chrome/stub_devtools_client.h"
+#include "chrome/test/chromedriver/chrome/stub_chrome.h"
+#include "chrome/test/chromedriver/chrome/stub_web_view.h"
+#include "chrome/test/chromedriver/commands.h"
+#include "chrome/test/chromedriver/session.h"
+#include "chrome/test/chromedriver/session_commands.h"
+#include "chrome/test/chromedriver/session_thread_map.h"
+
+namespace {
+
+const char kWebViewId[] = "stress-web-view";
+
+// A DevTools client that answers every command after |latency|, as if it
+// waited for the browser.
+class StressDevToolsClient : public StubDevToolsClient {
+ public:
+  explicit StressDevToolsClient(base::TimeDelta latency)
+      : StubDevToolsClient(kWebViewId), latency_(latency) {}
+  ~StressDevToolsClient() override = default;
+
+  // Overridden from DevToolsClient:
+  Status SendCommandAndGetResult(const std::string& method,
+                                 const base::DictionaryValue& params,
+                                 base::Value* result) override {
+    base::PlatformThread::Sleep(latency_);
+    return StubDevToolsClient::SendCommandAndGetResult(method, params, result);
+  }
+
+ private:
+  const base::TimeDelta latency_;
+};
+
+// A tab that sends its DevTools commands through a StressDevToolsClient.
+class StressWebView : public StubWebView {
+ public:
+  explicit StressWebView(base::TimeDelta browser_latency)
+      : StubWebView(kWebViewId), client_(browser_latency) {}
+  ~StressWebView() override = default;
+
+  // Overridden from WebView:
+  Status SendCommand(const std::string& cmd,
+                     const base::DictionaryValue& params) override {
+    return client_.SendCommand(cmd, params);
+  }
+  Status SendCommandAndGetResult(const std::string& cmd,
+                                 const base::DictionaryValue& params,
+                                 std::unique_ptr<base::Value>* value) override {
+    base::Value result;
+    Status status = client_.SendCommandAndGetResult(cmd, params, &result);
+    if (status.IsError())
+      return status;
+    *value = std::make_unique<base::Value>(std::move(result));
+    return Status(kOk);
+  }
+
+ private:
+  StressDevToolsClient client_;
+};
+
+// A browser with a single tab.
+class StressChrome : public StubChrome {
+ public:
+  explicit StressChrome(base::TimeDelta browser_latency)
+      : web_view_(browser_latency) {}
+  ~StressChrome() override = default;
+
+  // Overridden from Chrome:
+  Status GetWebViewIds(std::list<std::string>* web_view_ids,
+                       bool w3c_compliant) override {
+    web_view_ids->push_back(kWebViewId);
+    return Status(kOk);
+  }
+  Status GetWebViewById(const std::string& id, WebView** web_view) override {
+    if (id != kWebViewId)
+      return Status(kNoSuchWindow);
+    *web_view = &web_view_;
+    return Status(kOk);
+  }
+
+ private:
+  StressWebView web_view_;
+};
+
+Status ExecuteInitStressSession(base::TimeDelta browser_latency,
+                                Session* session,
+                                const base::DictionaryValue& params,
+                                std::unique_ptr<base::Value>* value) {
+  session->chrome = std::make_unique<StressChrome>(browser_latency);
+  session->window = kWebViewId;
+  session->capabilities = std::make_unique<base::DictionaryValue>();
+  *value = std::make_unique<base::Value>(base::Value::Type::DICTIONARY);
+  return Status(kOk);
+}
+
+// Stands for a command blocked on the browser, e.g. waiting for a DevTools
+// response.
+Status ExecuteBrowserWait(base::TimeDelta latency,
+                          Session* session,
+                          const base::DictionaryValue& params,
+                          std::unique_ptr<base::Value>* value) {
+  base::PlatformThread::Sleep(latency);
+  return Status(kOk);
+}
+
+// Sends a DevTools command to the current tab.
+Status ExecuteDevToolsCommand(Session* session,
+                              const base::DictionaryValue& params,
+                              std::unique_ptr<base::Value>* value) {
+  WebView* web_view = nullptr;
+  Status status = session->chrome->GetWebViewById(session->window, &web_view);
+  if (status.IsError())
+    return status;
+  return web_view->SendCommandAndGetResult("Runtime.evaluate", params, value);
+}
+
+Status ExecuteQuitStressSession(Session* session,
+                                const base::DictionaryValue& params,
+                                std::unique_ptr<base::Value>* value) {
+  session->quit = true;
+  return Status(kOk);
+}
+
+struct StressCommand {
+  std::string name;
+  SessionCommand command;
+  base::Value::Dict params;
+  int weight = 1;
+};
+
+std::vector<StressCommand> GetStressCommands(
+    base::TimeDelta browser_latency) {
+  std::vector<StressCommand> commands(6);
+  commands[0].name = "getTimeouts";
+  commands[0].command = base::BindRepeating(&ExecuteGetTimeouts);
+  commands[1].name = "setTimeouts";
+  commands[1].command = base::BindRepeating(&ExecuteSetTimeoutsW3C);
+  commands[1].params.Set("implicit", 0);
+  commands[2].name = "getWindowHandles";
+  commands[2].command = base::BindRepeating(&ExecuteGetWindowHandles);
+  commands[3].name = "getCurrentWindowHandle";
+  commands[3].command = base::BindRepeating(&ExecuteGetCurrentWindowHandle);
+  commands[4].name = "browserWait";
+  commands[4].command =
+      base::BindRepeating(&ExecuteBrowserWait, browser_latency);
+  commands[5].name = "devtoolsCommand";
+  commands[5].command = base::BindRepeating(&ExecuteDevToolsCommand);
+  commands[5].params.Set("expression", "1");
+  return commands;
+}
+
+// Applies --mix=name:weight,... to |commands|. Commands missing from the mix
+// get a zero weight.
+bool ParseMix(const std::string& mix, std::vector<StressCommand>* commands) {
+  for (StressCommand& command : *commands)
+    command.weight = 0;
+  for (const std::string& entry : base::SplitString(
+           mix, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    std::vector<std::string> parts = base::SplitString(
+        entry, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    int weight = 1;
+    if (parts.size() > 2 ||
+        (parts.size() == 2 &&
+         (!base::StringToInt(parts[1], &weight) || weight < 0))) {
+      return false;
+    }
+    auto iter = std::find_if(commands->begin(), commands->end(),
+                             [&parts](const StressCommand& command) {
+                               return command.name == parts[0];
+                             });
+    if (iter == commands->end())
+      return false;
+    iter->weight = weight;
+  }
+  return std::any_of(
+      commands->begin(), commands->end(),
+      [](const StressCommand& command) { return command.weight > 0; });
+}
+
+const StressCommand& PickCommand(const std::vector<StressCommand>& commands) {
+  int total_weight = 0;
+  for (const StressCommand& command : commands)
+    total_weight += command.weight;
+  int pick = base::RandInt(0, total_weight - 1);
+  for (const StressCommand& command : commands) {
+    if (pick < command.weight)
+      return command;
+    pick -= command.weight;
+  }
+  return commands.back();
+}
+
+base::TimeDelta Percentile(std::vector<base::TimeDelta>* latencies,
+                           double percentile) {
+  if (latencies->empty())
+    return base::TimeDelta();
+  size_t index = static_cast<size_t>(percentile * (latencies->size() - 1));
+  std::nth_element(latencies->begin(), latencies->begin() + index,
+                   latencies->end());
+  return (*latencies)[index];
+}
+
+// Returns the value of the |field| line of /proc/self/status, e.g. "Threads",
+// or "n/a" where it is not available.
+std::string GetProcessStatusField(const std::string& field) {
+#if BUILDFLAG(IS_LINUX) || BUILDFLAG(IS_CHROMEOS) || BUILDFLAG(IS_ANDROID)
+  std::string status;
+  if (base::ReadFileToString(base::FilePath("/proc/self/status"), &status)) {
+    for (const std::string& line : base::SplitString(
+             status, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+      if (base::StartsWith(line, field + ":")) {
+        return std::string(base::TrimWhitespaceASCII(
+            line.substr(field.size() + 1), base::TRIM_ALL));
+      }
+    }
+  }
+#endif
+  return "n/a";
+}
+
+class StressRunner {
+ public:
+  StressRunner(std::vector<StressCommand> commands,
+               size_t session_count,
+               size_t commands_per_session,
+               size_t round_count,
+               base::TimeDelta browser_latency,
+               base::OnceClosure on_done)
+      : commands_(std::move(commands)),
+        session_count_(session_count),
+        commands_per_session_(commands_per_session),
+        round_count_(round_count),
+        browser_latency_(browser_latency),
+        on_done_(std::move(on_done)) {}
+
+  void Start() {
+    start_time_ = base::TimeTicks::Now();
+    StartRound();
+  }
+
+  void PrintReport() {
+    base::TimeDelta elapsed = base::TimeTicks::Now() - start_time_;
+    size_t total = 0;
+    std::vector<base::TimeDelta> all_latencies;
+    printf("%-24s %10s %10s %10s\n", "command", "count", "p50 (ms)",
+           "p99 (ms)");
+    for (auto& [name, latencies] : latencies_) {
+      total += latencies.size();
+      all_latencies.insert(all_latencies.end(), latencies.begin(),
+                           latencies.end());
+      printf("%-24s %10zu %10.3f %10.3f\n", name.c_str(), latencies.size(),
+             Percentile(&latencies, 0.5).InMillisecondsF(),
+             Percentile(&latencies, 0.99).InMillisecondsF());
+    }
+    printf("%-24s %10zu %10.3f %10.3f\n", "all", total,
+           Percentile(&all_latencies, 0.5).InMillisecondsF(),
+           Percentile(&all_latencies, 0.99).InMillisecondsF());
+    printf("%-24s %10zu %10.3f %10.3f\n", "(session start)",
+           session_start_latencies_.size(),
+           Percentile(&session_start_latencies_, 0.5).InMillisecondsF(),
+           Percentile(&session_start_latencies_, 0.99).InMillisecondsF());
+    printf("sessions: %zu x %zu rounds, errors: %zu, elapsed: %.3f s\n",
+           session_count_, round_count_, error_count_, elapsed.InSecondsF());
+    printf("throughput: %.1f commands/s\n", total / elapsed.InSecondsF());
+    printf("peak threads: %zu, peak RSS: %s\n", peak_thread_count_,
+           GetProcessStatusField("VmHWM").c_str());
+  }
+
+ private:
+  void StartRound() {
+    finished_session_count_ = 0;
+    Command init_session_cmd = base::BindRepeating(
+        &ExecuteSessionCommand, &session_thread_map_, "initSession",
+        base::BindRepeating(&ExecuteInitStressSession, browser_latency_),
+        true /*w3c_standard_command*/, false);
+    for (size_t i = 0; i < session_count_; ++i) {
+      ExecuteCreateSession(
+          &session_thread_map_, init_session_cmd, base::Value::Dict(),
+          "localhost",
+          base::BindRepeating(&StressRunner::OnSessionCreated,
+                              base::Unretained(this), base::TimeTicks::Now()));
+    }
+  }
+
+  void OnSessionCreated(base::TimeTicks create_time,
+                        const Status& status,
+                        std::unique_ptr<base::Value> value,
+                        const std::string& session_id,
+                        bool w3c_compliant) {
+    if (status.IsError()) {
+      printf("failed to create a session: %s\n", status.message().c_str());
+      ++error_count_;
+      FinishSession();
+      return;
+    }
+    session_start_latencies_.push_back(base::TimeTicks::Now() - create_time);
+    // Reading the thread count is too slow to do for every command. It peaks
+    // while the sessions are created anyway.
+    peak_thread_count_ = std::max(peak_thread_count_, GetThreadCount());
+    remaining_commands_[session_id] = commands_per_session_;
+    SendNextCommand(session_id);
+  }
+
+  void SendNextCommand(const std::string& session_id) {
+    size_t& remaining = remaining_commands_[session_id];
+    if (!remaining) {
+      ExecuteSessionCommand(
+          &session_thread_map_, "quit",
+          base::BindRepeating(&ExecuteQuitStressSession),
+          true /*w3c_standard_command*/, false, base::Value::Dict(),
+          session_id,
+          base::BindRepeating(&StressRunner::OnSessionQuit,
+                              base::Unretained(this)));
+      return;
+    }
+    --remaining;
+    const StressCommand& command = PickCommand(commands_);
+    ExecuteSessionCommand(
+        &session_thread_map_, command.name.c_str(), command.command,
+        true /*w3c_standard_command*/, false, command.params.Clone(),
+        session_id,
+        base::BindRepeating(&StressRunner::OnCommandDone,
+                            base::Unretained(this), &command,
+                            base::TimeTicks::Now()));
+  }
+
+  void OnCommandDone(const StressCommand* command,
+                     base::TimeTicks send_time,
+                     const Status& status,
+                     std::unique_ptr<base::Value> value,
+                     const std::string& session_id,
+                     bool w3c_compliant) {
+    latencies_[command->name].push_back(base::TimeTicks::Now() - send_time);
+    if (status.IsError())
+      ++error_count_;
+    SendNextCommand(session_id);
+  }
+
+  void OnSessionQuit(const Status& status,
+                     std::unique_ptr<base::Value> value,
+                     const std::string& session_id,
+                     bool w3c_compliant) {
+    if (status.IsError())
+      ++error_count_;
+    FinishSession();
+  }
+
+  void FinishSession() {
+    if (++finished_session_count_ < session_count_)
+      return;
+    remaining_commands_.clear();
+    // The last session releases its thread in a task posted after its quit
+    // response. Start the next round after it, so that the thread is reused.
+    if (++finished_round_count_ < round_count_) {
+      base::ThreadTaskRunnerHandle::Get()->PostTask(
+          FROM_HERE, base::BindOnce(&StressRunner::StartRound,
+                                    base::Unretained(this)));
+      return;
+    }
+    std::move(on_done_).Run();
+  }
+
+  static size_t GetThreadCount() {
+    size_t thread_count = 0;
+    base::StringToSizeT(GetProcessStatusField("Threads"), &thread_count);
+    return thread_count;
+  }
+
+  const std::vector<StressCommand> commands_;
+  const size_t session_count_;
+  const size_t commands_per_session_;
+  const size_t round_count_;
+  const base::TimeDelta browser_latency_;
+  base::OnceClosure on_done_;
+  SessionThreadMap session_thread_map_;
+  std::map<std::string, size_t> remaining_commands_;
+  std::map<std::string, std::vector<base::TimeDelta>> latencies_;
+  std::vector<base::TimeDelta> session_start_latencies_;
+  base::TimeTicks start_time_;
+  size_t finished_session_count_ = 0;
+  size_t finished_round_count_ = 0;
+  size_t error_count_ = 0;
+  size_t peak_thread_count_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  base::AtExitManager at_exit;
+  base::CommandLine::Init(argc, argv);
+  base::CommandLine* cmd_line = base::CommandLine::ForCurrentProcess();
+
+  if (cmd_line->HasSwitch("h") || cmd_line->HasSwitch("help")) {
+    printf(
+        "Usage: %s [OPTIONS]\n\n"
+        "Options\n"
+        "  --sessions=N               number of concurrent sessions (8)\n"
+        "  --commands=N               commands per session (1000)\n"
+        "  --mix=NAME:WEIGHT,...      command mix, out of getTimeouts,\n"
+        "                             setTimeouts, getWindowHandles,\n"
+        "                             getCurrentWindowHandle, browserWait,\n"
+        "                             devtoolsCommand\n"
+        "                             (all with weight 1)\n"
+        "  --browser-latency-ms=N     duration of browserWait and of the\n"
+        "                             DevTools responses (1)\n"
+        "  --rounds=N                 times the sessions are created, run\n"
+        "                             and quit (1)\n"
+        "  --no-thread-reuse          start a new thread for every session\n",
+        argv[0]);
+    return 0;
+  }
+
+  size_t session_count = 8;
+  size_t commands_per_session = 1000;
+  int browser_latency_ms = 1;
+  size_t round_count = 1;
+  if ((cmd_line->HasSwitch("sessions") &&
+       (!base::StringToSizeT(cmd_line->GetSwitchValueASCII("sessions"),
+                             &session_count) ||
+        !session_count)) ||
+      (cmd_line->HasSwitch("commands") &&
+       !base::StringToSizeT(cmd_line->GetSwitchValueASCII("commands"),
+                            &commands_per_session)) ||
+      (cmd_line->HasSwitch("browser-latency-ms") &&
+       (!base::StringToInt(cmd_line->GetSwitchValueASCII("browser-latency-ms"),
+                           &browser_latency_ms) ||
+        browser_latency_ms < 0)) ||
+      (cmd_line->HasSwitch("rounds") &&
+       (!base::StringToSizeT(cmd_line->GetSwitchValueASCII("rounds"),
+                             &round_count) ||
+        !round_count))) {
+    printf(
+        "Invalid --sessions, --commands, --browser-latency-ms or --rounds "
+        "value.\n");
+    return 1;
+  }
+  std::vector<StressCommand> commands =
+      GetStressCommands(base::Milliseconds(browser_latency_ms));
+  if (cmd_line->HasSwitch("mix") &&
+      !ParseMix(cmd_line->GetSwitchValueASCII("mix"), &commands)) {
+    printf("Invalid --mix value.\n");
+    return 1;
+  }
+
+  base::SingleThreadTaskExecutor main_task_executor;
+  if (cmd_line->HasSwitch("no-thread-reuse"))
+    SetSessionThreadReuse(false);
+  base::RunLoop run_loop;
+  StressRunner runner(std::move(commands), session_count, commands_per_session,
+                      round_count, base::Milliseconds(browser_latency_ms),
+                      run_loop.QuitClosure());
+  runner.Start();
+  run_loop.Run();
+  runner.PrintReport();
+  // |at_exit| joins the idle session threads.
+  return 0;
+}
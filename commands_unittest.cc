@@ -13,14 +13,19 @@
 
 #include "base/bind.h"
 #include "base/callback.h"
+#include "base/callback_helpers.h"
 #include "base/compiler_specific.h"
 #include "base/files/file_path.h"
 #include "base/location.h"
+#include "base/process/process_metrics.h"
 #include "base/run_loop.h"
 #include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
 #include "base/task/single_thread_task_runner.h"
 #include "base/test/task_environment.h"
+#include "base/threading/platform_thread.h"
 #include "base/threading/thread.h"
+#include "base/time/time.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/status.h"
 #include "chrome/test/chromedriver/chrome/stub_chrome.h"
@@ -56,14 +61,14 @@ void OnGetStatus(const Status& status,
 
 TEST(CommandsTest, GetStatus) {
   base::Value params(base::Value::Type::DICTIONARY);
-  ExecuteGetStatus(base::Value::AsDictionaryValue(params), std::string(),
+  ExecuteGetStatus(params.GetDict().Clone(), std::string(),
                    base::BindRepeating(&OnGetStatus));
 }
 
 namespace {
 
 void ExecuteStubGetSession(int* count,
-                           const base::DictionaryValue& params,
+                           base::Value::Dict params,
                            const std::string& session_id,
                            const CommandCallback& callback) {
   if (*count == 0) {
@@ -152,7 +157,7 @@ TEST(CommandsTest, GetSessions) {
   base::Value params(base::Value::Type::DICTIONARY);
   base::test::SingleThreadTaskEnvironment task_environment;
 
-  ExecuteGetSessions(cmd, &map, base::Value::AsDictionaryValue(params),
+  ExecuteGetSessions(cmd, &map, params.GetDict().Clone(),
                      std::string(), base::BindRepeating(&OnGetSessions));
   ASSERT_EQ(2, count);
 }
@@ -161,7 +166,7 @@ namespace {
 
 void ExecuteStubQuit(
     int* count,
-    const base::DictionaryValue& params,
+    base::Value::Dict params,
     const std::string& session_id,
     const CommandCallback& callback) {
   if (*count == 0) {
@@ -194,13 +199,66 @@ TEST(CommandsTest, QuitAll) {
   Command cmd = base::BindRepeating(&ExecuteStubQuit, &count);
   base::Value params(base::Value::Type::DICTIONARY);
   base::test::SingleThreadTaskEnvironment task_environment;
-  ExecuteQuitAll(cmd, &map, base::Value::AsDictionaryValue(params),
+  ExecuteQuitAll(cmd, &map, params.GetDict().Clone(),
                  std::string(), base::BindRepeating(&OnQuitAll));
   ASSERT_EQ(2, count);
 }
 
 namespace {
 
+void ExecuteStubPendingQuit(std::vector<CommandCallback>* pending_quits,
+                            base::Value::Dict params,
+                            const std::string& session_id,
+                            const CommandCallback& callback) {
+  pending_quits->push_back(callback);
+}
+
+void StoreQuitAllResult(bool* is_called,
+                        std::unique_ptr<base::Value>* result,
+                        const Status& status,
+                        std::unique_ptr<base::Value> value,
+                        const std::string& session_id,
+                        bool w3c_compliant) {
+  EXPECT_EQ(kOk, status.code());
+  *is_called = true;
+  *result = std::move(value);
+}
+
+}  // namespace
+
+TEST(CommandsTest, QuitAllDoesNotBlockAndReportsTimedOutSessions) {
+  SessionThreadMap map;
+  map["id"] = std::make_unique<SessionThreadInfo>("1", true);
+  map["id2"] = std::make_unique<SessionThreadInfo>("2", true);
+
+  std::vector<CommandCallback> pending_quits;
+  Command cmd = base::BindRepeating(&ExecuteStubPendingQuit, &pending_quits);
+  base::test::SingleThreadTaskEnvironment task_environment(
+      base::test::TaskEnvironment::TimeSource::MOCK_TIME);
+  bool is_called = false;
+  std::unique_ptr<base::Value> result;
+  ExecuteQuitAll(
+      cmd, &map, base::Value::Dict(), std::string(),
+      base::BindRepeating(&StoreQuitAllResult, &is_called, &result));
+  // Both quit commands were sent without waiting for either to finish.
+  ASSERT_EQ(2u, pending_quits.size());
+  EXPECT_FALSE(is_called);
+
+  pending_quits[0].Run(Status(kOk), nullptr, "id", false);
+  EXPECT_FALSE(is_called);
+
+  task_environment.FastForwardBy(base::Seconds(10));
+  ASSERT_TRUE(is_called);
+  ASSERT_TRUE(result && result->is_dict());
+  EXPECT_EQ(1u, result->GetDict().size());
+  EXPECT_TRUE(result->GetDict().FindString("id2"));
+
+  // A late response is ignored.
+  pending_quits[1].Run(Status(kOk), nullptr, "id2", false);
+}
+
+namespace {
+
 Status ExecuteSimpleCommand(const std::string& expected_id,
                             base::Value* expected_params,
                             base::Value* value,
@@ -251,13 +309,442 @@ TEST(CommandsTest, ExecuteSessionCommand) {
   base::RunLoop run_loop;
   ExecuteSessionCommand(
       &map, "cmd", cmd, true /*w3c_standard_command*/, false,
-      base::Value::AsDictionaryValue(params), id,
+      params.GetDict().Clone(), id,
       base::BindRepeating(&OnSimpleCommand, &run_loop, id, &expected_value));
   run_loop.Run();
 }
 
 namespace {
 
+Status ExecuteQuitSessionForTesting(Session* session,
+                                    const base::DictionaryValue& params,
+                                    std::unique_ptr<base::Value>* value) {
+  session->quit = true;
+  return Status(kOk);
+}
+
+void OnQuitSession(base::RunLoop* run_loop,
+                   const Status& status,
+                   std::unique_ptr<base::Value> value,
+                   const std::string& session_id,
+                   bool w3c_compliant) {
+  EXPECT_EQ(kOk, status.code());
+  run_loop->Quit();
+}
+
+void InitSessionForTesting(bool* is_called,
+                           base::Value::Dict params,
+                           const std::string& session_id,
+                           const CommandCallback& callback) {
+  *is_called = true;
+}
+
+void ShouldNotFailToCreateSession(const Status& status,
+                                  std::unique_ptr<base::Value> value,
+                                  const std::string& session_id,
+                                  bool w3c_compliant) {
+  EXPECT_TRUE(false) << status.message();
+}
+
+}  // namespace
+
+TEST(CommandsTest, SessionThreadIsReusedAfterQuit) {
+  SessionThreadMap map;
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::test::SingleThreadTaskEnvironment task_environment;
+  base::Value params(base::Value::Type::DICTIONARY);
+  size_t idle_thread_count = internal::GetIdleSessionThreadCountForTesting();
+  base::RunLoop run_loop;
+  ExecuteSessionCommand(&map, "quit",
+                        base::BindRepeating(&ExecuteQuitSessionForTesting),
+                        true /*w3c_standard_command*/, false,
+                        params.GetDict().Clone(), id,
+                        base::BindRepeating(&OnQuitSession, &run_loop));
+  run_loop.Run();
+  // The session thread is released once the session is deleted on it.
+  while (map.count(id))
+    base::RunLoop().RunUntilIdle();
+  ASSERT_EQ(idle_thread_count + 1,
+            internal::GetIdleSessionThreadCountForTesting());
+
+  bool is_init_called = false;
+  ExecuteCreateSession(
+      &map, base::BindRepeating(&InitSessionForTesting, &is_init_called),
+      params.GetDict().Clone(), "host",
+      base::BindRepeating(&ShouldNotFailToCreateSession));
+  EXPECT_TRUE(is_init_called);
+  ASSERT_EQ(1u, map.size());
+  base::Thread* thread = map.begin()->second->thread();
+  EXPECT_TRUE(thread->IsRunning());
+  EXPECT_EQ(idle_thread_count, internal::GetIdleSessionThreadCountForTesting());
+
+  // The reused thread is renamed after the new session.
+  std::string thread_name;
+  base::RunLoop name_run_loop;
+  thread->task_runner()->PostTaskAndReply(
+      FROM_HERE,
+      base::BindOnce(
+          [](std::string* name) { *name = base::PlatformThread::GetName(); },
+          &thread_name),
+      name_run_loop.QuitClosure());
+  name_run_loop.Run();
+  EXPECT_EQ(map.begin()->first, thread_name);
+}
+
+TEST(CommandsTest, ShutdownIdleSessionThreads) {
+  SessionThreadMap map;
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::test::SingleThreadTaskEnvironment task_environment;
+  base::RunLoop run_loop;
+  ExecuteSessionCommand(&map, "quit",
+                        base::BindRepeating(&ExecuteQuitSessionForTesting),
+                        true /*w3c_standard_command*/, false,
+                        base::Value::Dict(), id,
+                        base::BindRepeating(&OnQuitSession, &run_loop));
+  run_loop.Run();
+  while (map.count(id))
+    base::RunLoop().RunUntilIdle();
+  ASSERT_LT(0u, internal::GetIdleSessionThreadCountForTesting());
+
+  ShutdownIdleSessionThreads();
+  EXPECT_EQ(0u, internal::GetIdleSessionThreadCountForTesting());
+}
+
+TEST(CommandsTest, SessionThreadIsNotKeptWithoutReuse) {
+  SessionThreadMap map;
+  base::test::SingleThreadTaskEnvironment task_environment;
+  SetSessionThreadReuse(false);
+  EXPECT_EQ(0u, internal::GetIdleSessionThreadCountForTesting());
+
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::RunLoop run_loop;
+  ExecuteSessionCommand(&map, "quit",
+                        base::BindRepeating(&ExecuteQuitSessionForTesting),
+                        true /*w3c_standard_command*/, false,
+                        base::Value::Dict(), id,
+                        base::BindRepeating(&OnQuitSession, &run_loop));
+  run_loop.Run();
+  while (map.count(id))
+    base::RunLoop().RunUntilIdle();
+  EXPECT_EQ(0u, internal::GetIdleSessionThreadCountForTesting());
+  SetSessionThreadReuse(true);
+}
+
+namespace {
+
+void StoreStatusValue(std::unique_ptr<base::Value>* out_value,
+                      const Status& status,
+                      std::unique_ptr<base::Value> value,
+                      const std::string& session_id,
+                      bool w3c_compliant) {
+  ASSERT_EQ(kOk, status.code());
+  *out_value = std::move(value);
+}
+
+Status ExecuteNoopCommand(Session* session,
+                          const base::DictionaryValue& params,
+                          std::unique_ptr<base::Value>* value) {
+  return Status(kOk);
+}
+
+Status ExecuteCheckLatenciesAndQuit(Session* session,
+                                    const base::DictionaryValue& params,
+                                    std::unique_ptr<base::Value>* value) {
+  EXPECT_EQ(1u, session->command_latencies.size());
+  auto iter = session->command_latencies.find("noop");
+  EXPECT_NE(session->command_latencies.end(), iter);
+  if (iter != session->command_latencies.end()) {
+    EXPECT_EQ(1, iter->second.queueing.count());
+    EXPECT_EQ(1, iter->second.execution.count());
+    EXPECT_EQ(1, iter->second.devtools_wait.count());
+    EXPECT_TRUE(iter->second.devtools_wait.total().is_zero());
+  }
+  session->quit = true;
+  return Status(kOk);
+}
+
+}  // namespace
+
+TEST(CommandsTest, RecordsCommandLatencies) {
+  SessionThreadMap map;
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::test::SingleThreadTaskEnvironment task_environment;
+  {
+    base::RunLoop run_loop;
+    ExecuteSessionCommand(&map, "noop",
+                          base::BindRepeating(&ExecuteNoopCommand),
+                          true /*w3c_standard_command*/, false,
+                          base::Value::Dict(), id,
+                          base::BindRepeating(&OnQuitSession, &run_loop));
+    run_loop.Run();
+  }
+  {
+    base::RunLoop run_loop;
+    ExecuteSessionCommand(&map, "check",
+                          base::BindRepeating(&ExecuteCheckLatenciesAndQuit),
+                          true /*w3c_standard_command*/, false,
+                          base::Value::Dict(), id,
+                          base::BindRepeating(&OnQuitSession, &run_loop));
+    run_loop.Run();
+  }
+
+  std::unique_ptr<base::Value> status;
+  ExecuteGetStatus(base::Value::Dict(), std::string(),
+                   base::BindRepeating(&StoreStatusValue, &status));
+  ASSERT_TRUE(status && status->is_dict());
+  const base::Value::Dict* latencies =
+      status->GetDict().FindDict("commandLatencies");
+  ASSERT_TRUE(latencies);
+  EXPECT_TRUE(latencies->FindDict("noop"));
+}
+
+namespace {
+
+Status ExecuteEnableCoalescedReads(Session* session,
+                                   const base::DictionaryValue& params,
+                                   std::unique_ptr<base::Value>* value) {
+  session->coalesce_reads = true;
+  return Status(kOk);
+}
+
+Status ExecuteCountedRead(int* count,
+                          Session* session,
+                          const base::DictionaryValue& params,
+                          std::unique_ptr<base::Value>* value) {
+  (*count)++;
+  *value = std::make_unique<base::Value>(*count);
+  return Status(kOk);
+}
+
+Status ExecuteWaitForEvent(base::WaitableEvent* event,
+                          Session* session,
+                          const base::DictionaryValue& params,
+                          std::unique_ptr<base::Value>* value) {
+  event->Wait();
+  return Status(kOk);
+}
+
+void StoreIntResult(base::RunLoop* run_loop,
+                    int* result,
+                    const Status& status,
+                    std::unique_ptr<base::Value> value,
+                    const std::string& session_id,
+                    bool w3c_compliant) {
+  EXPECT_EQ(kOk, status.code());
+  ASSERT_TRUE(value && value->is_int());
+  *result = value->GetInt();
+  run_loop->Quit();
+}
+
+}  // namespace
+
+TEST(CommandsTest, CoalescesReadOnlyCommands) {
+  SessionThreadMap map;
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::test::SingleThreadTaskEnvironment task_environment;
+  auto run_command = [&map, &id](const char* name, SessionCommand command) {
+    base::RunLoop run_loop;
+    ExecuteSessionCommand(&map, name, command, true /*w3c_standard_command*/,
+                          false, base::Value::Dict(), id,
+                          base::BindRepeating(&OnQuitSession, &run_loop));
+    run_loop.Run();
+  };
+  int count = 0;
+  auto read_title = [&map, &id, &count]() {
+    base::RunLoop run_loop;
+    int result = 0;
+    ExecuteSessionCommand(
+        &map, "GetTitle", base::BindRepeating(&ExecuteCountedRead, &count),
+        true /*w3c_standard_command*/, false, base::Value::Dict(), id,
+        base::BindRepeating(&StoreIntResult, &run_loop, &result));
+    run_loop.Run();
+    return result;
+  };
+
+  // Reads are not shared unless the session enabled it.
+  EXPECT_EQ(1, read_title());
+  EXPECT_EQ(2, read_title());
+
+  run_command("enable", base::BindRepeating(&ExecuteEnableCoalescedReads));
+  // The page may change on its own between two polls, without any event, so
+  // a read queued after the previous one completed runs again.
+  EXPECT_EQ(3, read_title());
+  EXPECT_EQ(4, read_title());
+
+  // The reads queued while the session thread is busy share a result.
+  {
+    base::WaitableEvent release;
+    ExecuteSessionCommand(&map, "Wait",
+                          base::BindRepeating(&ExecuteWaitForEvent, &release),
+                          true /*w3c_standard_command*/, false,
+                          base::Value::Dict(), id, base::DoNothing());
+    base::RunLoop run_loop1;
+    base::RunLoop run_loop2;
+    int result1 = 0;
+    int result2 = 0;
+    ExecuteSessionCommand(
+        &map, "GetTitle", base::BindRepeating(&ExecuteCountedRead, &count),
+        true /*w3c_standard_command*/, false, base::Value::Dict(), id,
+        base::BindRepeating(&StoreIntResult, &run_loop1, &result1));
+    ExecuteSessionCommand(
+        &map, "GetTitle", base::BindRepeating(&ExecuteCountedRead, &count),
+        true /*w3c_standard_command*/, false, base::Value::Dict(), id,
+        base::BindRepeating(&StoreIntResult, &run_loop2, &result2));
+    release.Signal();
+    run_loop1.Run();
+    run_loop2.Run();
+    EXPECT_EQ(5, result1);
+    EXPECT_EQ(5, result2);
+  }
+  EXPECT_EQ(5, count);
+
+  // Another command queued in between invalidates the shared result.
+  {
+    base::WaitableEvent release;
+    ExecuteSessionCommand(&map, "Wait",
+                          base::BindRepeating(&ExecuteWaitForEvent, &release),
+                          true /*w3c_standard_command*/, false,
+                          base::Value::Dict(), id, base::DoNothing());
+    base::RunLoop run_loop1;
+    base::RunLoop run_loop2;
+    int result1 = 0;
+    int result2 = 0;
+    ExecuteSessionCommand(
+        &map, "GetTitle", base::BindRepeating(&ExecuteCountedRead, &count),
+        true /*w3c_standard_command*/, false, base::Value::Dict(), id,
+        base::BindRepeating(&StoreIntResult, &run_loop1, &result1));
+    ExecuteSessionCommand(&map, "Click",
+                          base::BindRepeating(&ExecuteNoopCommand),
+                          true /*w3c_standard_command*/, false,
+                          base::Value::Dict(), id, base::DoNothing());
+    ExecuteSessionCommand(
+        &map, "GetTitle", base::BindRepeating(&ExecuteCountedRead, &count),
+        true /*w3c_standard_command*/, false, base::Value::Dict(), id,
+        base::BindRepeating(&StoreIntResult, &run_loop2, &result2));
+    release.Signal();
+    run_loop1.Run();
+    run_loop2.Run();
+    EXPECT_EQ(6, result1);
+    EXPECT_EQ(7, result2);
+  }
+
+  run_command("quit", base::BindRepeating(&ExecuteQuitSessionForTesting));
+}
+
+namespace {
+
+size_t GetMallocUsage() {
+  return base::ProcessMetrics::CreateCurrentProcessMetrics()->GetMallocUsage();
+}
+
+Status ExecuteUploadCommand(const char* expected_data,
+                            size_t malloc_usage_before,
+                            Session* session,
+                            const base::DictionaryValue& params,
+                            std::unique_ptr<base::Value>* value) {
+  const std::string* file = params.FindStringKey("file");
+  EXPECT_TRUE(file);
+  if (file) {
+    // The payload must arrive in the buffer allocated by the caller, and must
+    // not have been copied on the way either.
+    EXPECT_EQ(expected_data, file->data());
+    EXPECT_LT(GetMallocUsage(), malloc_usage_before + file->size() / 2);
+  }
+  session->quit = true;
+  return Status(kOk);
+}
+
+}  // namespace
+
+TEST(CommandsTest, ExecuteSessionCommandDoesNotCopyParams) {
+  SessionThreadMap map;
+  auto threadInfo = std::make_unique<SessionThreadInfo>("1", true);
+  ASSERT_TRUE(threadInfo->thread()->Start());
+  std::string id("id");
+  threadInfo->thread()->task_runner()->PostTask(
+      FROM_HERE,
+      base::BindOnce(&internal::CreateSessionOnSessionThreadForTesting, id));
+  map[id] = std::move(threadInfo);
+
+  base::Value::Dict params;
+  params.Set("file", std::string(10 * 1024 * 1024, 'a'));
+  const char* data = params.FindString("file")->data();
+
+  base::test::SingleThreadTaskEnvironment task_environment;
+  base::RunLoop run_loop;
+  ExecuteSessionCommand(
+      &map, "uploadFile",
+      base::BindRepeating(&ExecuteUploadCommand, data, GetMallocUsage()),
+      true /*w3c_standard_command*/, false, std::move(params), id,
+      base::BindRepeating(&OnQuitSession, &run_loop));
+  run_loop.Run();
+}
+
+namespace {
+
+void ExecuteStubCommandWithParamsByReference(
+    const char* expected_data,
+    bool* is_called,
+    const base::DictionaryValue& params,
+    const std::string& session_id,
+    const CommandCallback& callback) {
+  *is_called = true;
+  EXPECT_EQ("id", session_id);
+  const std::string* file = params.FindStringKey("file");
+  ASSERT_TRUE(file);
+  EXPECT_EQ(expected_data, file->data());
+}
+
+}  // namespace
+
+TEST(CommandsTest, AdaptCommandWithParamsByReference) {
+  base::Value::Dict params;
+  params.Set("file", std::string(1024, 'a'));
+  const char* data = params.FindString("file")->data();
+  bool is_called = false;
+  Command command = AdaptCommandWithParamsByReference(base::BindRepeating(
+      &ExecuteStubCommandWithParamsByReference, data, &is_called));
+  command.Run(std::move(params), "id", base::DoNothing());
+  EXPECT_TRUE(is_called);
+}
+
+namespace {
+
 Status ShouldNotBeCalled(Session* session,
                          const base::DictionaryValue& params,
                          std::unique_ptr<base::Value>* value) {
@@ -288,7 +775,7 @@ TEST(CommandsTest, ExecuteSessionCommandOnNoSuchSession) {
   base::Value params(base::Value::Type::DICTIONARY);
   ExecuteSessionCommand(&map, "cmd", base::BindRepeating(&ShouldNotBeCalled),
                         true /*w3c_standard_command*/, false,
-                        base::Value::AsDictionaryValue(params), "session",
+                        params.GetDict().Clone(), "session",
                         base::BindRepeating(&OnNoSuchSession));
 }
 
@@ -297,7 +784,7 @@ TEST(CommandsTest, ExecuteSessionCommandOnNoSuchSessionWhenItExpectsOk) {
   base::Value params(base::Value::Type::DICTIONARY);
   ExecuteSessionCommand(&map, "cmd", base::BindRepeating(&ShouldNotBeCalled),
                         true /*w3c_standard_command*/, true,
-                        base::Value::AsDictionaryValue(params), "session",
+                        params.GetDict().Clone(), "session",
                         base::BindRepeating(&OnNoSuchSessionIsOk));
 }
 
@@ -328,7 +815,7 @@ TEST(CommandsTest, ExecuteSessionCommandOnJustDeletedSession) {
   ExecuteSessionCommand(
       &map, "cmd", base::BindRepeating(&ShouldNotBeCalled),
       true /*w3c_standard_command*/, false,
-      base::Value::AsDictionaryValue(params), "session",
+      params.GetDict().Clone(), "session",
       base::BindRepeating(&OnNoSuchSessionAndQuit, &run_loop));
   run_loop.Run();
 }
@@ -610,6 +1097,144 @@ TEST(CommandsTest, TimeoutInFindElement) {
 
 namespace {
 
+// Never finds the element, and counts the attempts and the times the received
+// DevTools events are handled.
+class HandleEventsWebView : public StubWebView {
+ public:
+  HandleEventsWebView() : StubWebView("1") {}
+  ~HandleEventsWebView() override = default;
+
+  // Overridden from WebView:
+  Status CallFunction(const std::string& frame,
+                      const std::string& function,
+                      const base::Value::List& args,
+                      std::unique_ptr<base::Value>* result) override {
+    ++call_count_;
+    *result = std::make_unique<base::Value>();
+    return Status(kOk);
+  }
+
+  Status HandleReceivedEvents() override {
+    ++handle_count_;
+    return Status(kOk);
+  }
+
+  int call_count_ = 0;
+  int handle_count_ = 0;
+};
+
+}  // namespace
+
+TEST(CommandsTest, FindElementHandlesEventsWhileWaiting) {
+  Session session("id");
+  HandleEventsWebView web_view;
+  session.implicit_wait = base::Milliseconds(100);
+  base::Value params(base::Value::Type::DICTIONARY);
+  params.SetStringKey("using", "css selector");
+  params.SetStringKey("value", "#a");
+  std::unique_ptr<base::Value> result;
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  ASSERT_EQ(kNoSuchElement,
+            ExecuteFindElement(50, &session, &web_view,
+                               base::Value::AsDictionaryValue(params), &result,
+                               nullptr)
+                .code());
+
+  // The implicit wait is honored.
+  EXPECT_GE(base::TimeTicks::Now() - start_time, session.implicit_wait);
+  // The attempts are separated by the polling interval, i.e. made at 0 ms,
+  // then after 50 ms and 100 ms at the earliest.
+  EXPECT_GE(web_view.call_count_, 2);
+  EXPECT_LE(web_view.call_count_, 3);
+  // The events are handled while waiting between the attempts, at least at
+  // the start and at the end of each interval, not only once per attempt.
+  EXPECT_GE(web_view.handle_count_, 2 * (web_view.call_count_ - 1));
+}
+
+namespace {
+
+// Finds the element once the second element waiter has resolved; waiting for
+// the first one fails as if the frame navigated.
+class ElementWaiterWebView : public StubWebView {
+ public:
+  ElementWaiterWebView() : StubWebView("1") {}
+  ~ElementWaiterWebView() override {}
+
+  // Overridden from WebView:
+  Status CallFunction(const std::string& frame,
+                      const std::string& function,
+                      const base::Value::List& args,
+                      std::unique_ptr<base::Value>* result) override {
+    if (function ==
+        webdriver::atoms::asString(webdriver::atoms::FIND_ELEMENT)) {
+      ++finds_;
+      if (waits_ < 2) {
+        *result = std::make_unique<base::Value>();
+      } else {
+        base::Value element(base::Value::Type::DICTIONARY);
+        element.SetStringKey("ELEMENT", "1");
+        *result = base::Value::ToUniquePtrValue(std::move(element));
+      }
+    } else {
+      ++installs_;
+      EXPECT_EQ(2U, args.size());
+      EXPECT_TRUE(args[0].is_int());
+      EXPECT_GT(args[0].GetInt(), 0);
+    }
+    return Status(kOk);
+  }
+
+  Status EvaluateScript(const std::string& frame,
+                        const std::string& expression,
+                        const bool await_promise,
+                        std::unique_ptr<base::Value>* result) override {
+    if (!await_promise) {
+      ++stops_;
+      return Status(kOk);
+    }
+    if (++waits_ == 1)
+      return Status(kNoSuchExecutionContext);
+    *result = std::make_unique<base::Value>(true);
+    return Status(kOk);
+  }
+
+  int finds() const { return finds_; }
+  int installs() const { return installs_; }
+  int waits() const { return waits_; }
+  int stops() const { return stops_; }
+
+ private:
+  int finds_ = 0;
+  int installs_ = 0;
+  int waits_ = 0;
+  int stops_ = 0;
+};
+
+}  // namespace
+
+TEST(CommandsTest, FindElementWaitsForMutations) {
+  ElementWaiterWebView web_view;
+  Session session("id");
+  session.implicit_wait = base::Seconds(10);
+  session.observe_element_waits = true;
+  base::Value params(base::Value::Type::DICTIONARY);
+  params.SetStringKey("using", "css selector");
+  params.SetStringKey("value", "#a");
+  std::unique_ptr<base::Value> result;
+  ASSERT_EQ(kOk, ExecuteFindElement(1, &session, &web_view,
+                                    base::Value::AsDictionaryValue(params),
+                                    &result, nullptr)
+                     .code());
+  ASSERT_TRUE(result && result->is_dict());
+  ASSERT_EQ(3, web_view.finds());
+  ASSERT_EQ(2, web_view.installs());
+  ASSERT_EQ(2, web_view.waits());
+  // The waiter that could not be awaited was stopped.
+  ASSERT_EQ(1, web_view.stops());
+}
+
+namespace {
+
 class ErrorCallFunctionWebView : public StubWebView {
  public:
   explicit ErrorCallFunctionWebView(StatusCode code)
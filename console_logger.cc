@@ -46,6 +46,14 @@ Status ConsoleLogger::OnConnected(DevToolsClient* client) {
   return client->SendCommand("Runtime.enable", params);
 }
 
+base::flat_set<std::string> ConsoleLogger::GetListenedEventMethods() const {
+  return {
+      "Log.entryAdded",
+      "Runtime.consoleAPICalled",
+      "Runtime.exceptionThrown",
+  };
+}
+
 Status ConsoleLogger::OnEvent(
     DevToolsClient* client,
     const std::string& method,
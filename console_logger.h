@@ -27,6 +27,7 @@ class ConsoleLogger : public DevToolsEventListener {
 
   // Enables Console events for the client, which must not be null.
   Status OnConnected(DevToolsClient* client) override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   // Translates an event into a log entry.
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
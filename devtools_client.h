@@ -7,8 +7,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/callback_forward.h"
+#include "base/memory/raw_ptr.h"
 
 namespace base {
 class Value;
@@ -26,6 +28,17 @@ class DevToolsClient {
   typedef base::RepeatingCallback<Status(bool* is_condition_met)>
       ConditionalFunc;
 
+  // Receives the outcome of a command sent by SendCommandAndGetResultAsync.
+  // On success the result is a base::Value(base::Value::Type::DICTIONARY).
+  typedef base::OnceCallback<void(const Status&, base::Value)> ResultCallback;
+
+  // A command sent as a part of a batch. |params| must outlive the
+  // SendCommandBatch call.
+  struct BatchCommand {
+    std::string method;
+    raw_ptr<const base::DictionaryValue> params;
+  };
+
   virtual ~DevToolsClient() = default;
 
   virtual const std::string& GetId() = 0;
@@ -70,6 +83,26 @@ class DevToolsClient {
       const std::string& method,
       const base::DictionaryValue& params) = 0;
 
+  // Sends the command and returns without waiting for the response.
+  // |callback| runs once the response is received, which happens whenever
+  // some caller processes the incoming messages, e.g. in HandleEventsUntil or
+  // while waiting for another command. If sending fails an error is returned
+  // and |callback| never runs.
+  virtual Status SendCommandAndGetResultAsync(
+      const std::string& method,
+      const base::DictionaryValue& params,
+      ResultCallback callback) = 0;
+
+  // Sends all the |commands| before waiting for any of their responses, which
+  // saves a round trip per command. The remote end processes them in order.
+  // If |statuses| is not null it receives the outcome of each command. Once
+  // waiting for a response fails, e.g. times out, the commands still pending
+  // fail with the same status without being waited for. The commands must be
+  // independent: all of them are sent even if an earlier one fails.
+  // Returns the first error among the commands, if any.
+  virtual Status SendCommandBatch(const std::vector<BatchCommand>& commands,
+                                  std::vector<Status>* statuses) = 0;
+
   // Adds a listener. This must only be done when the client is disconnected.
   virtual void AddListener(DevToolsEventListener* listener) = 0;
 
@@ -9,11 +9,15 @@
 
 #include "base/bind.h"
 #include "base/check.h"
+#include "base/containers/cxx20_erase.h"
 #include "base/i18n/message_formatter.h"
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
+#include "base/json/string_escape.h"
 #include "base/logging.h"
 #include "base/memory/raw_ptr.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/devtools_event_listener.h"
@@ -76,6 +80,93 @@ std::ostream& operator<<(std::ostream& os, const SessionId& ses_manip) {
   return os << " (session_id=" << ses_manip.session_id_ << ")";
 }
 
+void StoreCommandOutcome(bool* is_completed,
+                         Status* status,
+                         base::Value* result,
+                         const Status& outcome_status,
+                         base::Value outcome_result) {
+  *is_completed = true;
+  *status = outcome_status;
+  if (result && outcome_status.IsOk())
+    *result = std::move(outcome_result);
+}
+
+void SkipWhitespace(base::StringPiece message, size_t* pos) {
+  while (*pos < message.size() && base::IsAsciiWhitespace(message[*pos]))
+    ++*pos;
+}
+
+// Reads the string starting at |*pos|. Escape sequences are not supported.
+bool ScanSimpleString(base::StringPiece message,
+                      size_t* pos,
+                      base::StringPiece* out) {
+  if (*pos >= message.size() || message[*pos] != '"')
+    return false;
+  const size_t start = *pos + 1;
+  for (size_t i = start; i < message.size(); ++i) {
+    if (message[i] == '\\')
+      return false;
+    if (message[i] == '"') {
+      *out = message.substr(start, i - start);
+      *pos = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SkipString(base::StringPiece message, size_t* pos) {
+  if (*pos >= message.size() || message[*pos] != '"')
+    return false;
+  for (size_t i = *pos + 1; i < message.size(); ++i) {
+    if (message[i] == '\\') {
+      ++i;
+    } else if (message[i] == '"') {
+      *pos = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SkipValue(base::StringPiece message, size_t* pos) {
+  SkipWhitespace(message, pos);
+  if (*pos >= message.size())
+    return false;
+  const char first = message[*pos];
+  if (first == '"')
+    return SkipString(message, pos);
+  if (first == '{' || first == '[') {
+    int depth = 0;
+    while (*pos < message.size()) {
+      const char c = message[*pos];
+      if (c == '"') {
+        if (!SkipString(message, pos))
+          return false;
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          ++*pos;
+          return true;
+        }
+      }
+      ++*pos;
+    }
+    return false;
+  }
+  // Numbers and the true, false and null literals.
+  const size_t start = *pos;
+  while (*pos < message.size() && message[*pos] != ',' &&
+         message[*pos] != '}' && message[*pos] != ']' &&
+         !base::IsAsciiWhitespace(message[*pos])) {
+    ++*pos;
+  }
+  return *pos > start;
+}
+
 }  // namespace
 
 namespace internal {
@@ -106,7 +197,15 @@ DevToolsClientImpl::DevToolsClientImpl(const std::string& id,
       id_(id),
       frontend_closer_func_(base::BindRepeating(&FakeCloseFrontends)),
       parser_func_(base::BindRepeating(&internal::ParseInspectorMessage)),
+      listens_to_all_events_(false),
+      event_filtering_enabled_(true),
+      next_connect_listener_(0),
+      connect_listeners_end_(0),
+      next_event_listener_(0),
+      event_listeners_end_(0),
       unnotified_event_(nullptr),
+      next_cmd_response_listener_(0),
+      cmd_response_listeners_end_(0),
       next_id_(1),
       stack_count_(0),
       is_remote_end_configured_(false),
@@ -131,7 +230,15 @@ DevToolsClientImpl::DevToolsClientImpl(const std::string& id,
       id_(id),
       frontend_closer_func_(base::BindRepeating(&FakeCloseFrontends)),
       parser_func_(base::BindRepeating(&internal::ParseInspectorMessage)),
+      listens_to_all_events_(false),
+      event_filtering_enabled_(true),
+      next_connect_listener_(0),
+      connect_listeners_end_(0),
+      next_event_listener_(0),
+      event_listeners_end_(0),
       unnotified_event_(nullptr),
+      next_cmd_response_listener_(0),
+      cmd_response_listeners_end_(0),
       next_id_(1),
       stack_count_(0),
       is_remote_end_configured_(false),
@@ -151,6 +258,8 @@ DevToolsClientImpl::~DevToolsClientImpl() {
 void DevToolsClientImpl::SetParserFuncForTesting(
     const ParserFunc& parser_func) {
   parser_func_ = parser_func;
+  // The custom parser may interpret the messages arbitrarily.
+  event_filtering_enabled_ = false;
 }
 
 void DevToolsClientImpl::SetFrontendCloserFunc(
@@ -244,17 +353,15 @@ void DevToolsClientImpl::ResetListeners() {
   // We are going to reconnect, therefore the remote end must be reconfigured
   is_remote_end_configured_ = false;
 
-  // These lines must be before the SendCommandXxx calls in SetUpDevTools
-  unnotified_connect_listeners_.clear();
-  for (DevToolsEventListener* listener : listeners_) {
-    if (listener->ListensToConnections()) {
-      unnotified_connect_listeners_.push_back(listener);
-    }
-  }
-  unnotified_event_listeners_.clear();
-  response_info_map_.clear();
+  // These lines must be before the SendCommandXxx calls in SetUpDevTools.
+  // Listeners not interested in connections are skipped by
+  // EnsureListenersNotifiedOfConnect.
+  next_connect_listener_ = 0;
+  connect_listeners_end_ = listeners_.size();
+  next_event_listener_ = event_listeners_end_ = 0;
+  response_infos_.Clear();
 
-  for (auto child : children_) {
+  for (const auto& child : children_) {
     child.second->ResetListeners();
   }
 }
@@ -281,7 +388,7 @@ Status DevToolsClientImpl::OnConnected() {
     return status;
   }
 
-  for (auto child : children_) {
+  for (const auto& child : children_) {
     status = child.second->OnConnected();
     if (status.IsError()) {
       break;
@@ -381,6 +488,81 @@ Status DevToolsClientImpl::SendCommandAndIgnoreResponse(
   return SendCommandInternal(method, params, nullptr, true, false, 0, nullptr);
 }
 
+Status DevToolsClientImpl::SendCommandAndGetResultAsync(
+    const std::string& method,
+    const base::DictionaryValue& params,
+    ResultCallback callback) {
+  int command_id;
+  scoped_refptr<ResponseInfo> response_info;
+  return PostCommand(method, params, 0, true, nullptr, std::move(callback),
+                     &command_id, &response_info);
+}
+
+Status DevToolsClientImpl::SendCommandBatch(
+    const std::vector<BatchCommand>& commands,
+    std::vector<Status>* statuses) {
+  struct PendingCommand {
+    int id = 0;
+    scoped_refptr<ResponseInfo> response_info;
+    bool is_completed = false;
+    Status status{kOk};
+  };
+  // Sized upfront: the completion callbacks point into the elements.
+  std::vector<PendingCommand> pending(commands.size());
+
+  // Write all the commands first. If writing fails the connection is broken
+  // and the remaining commands cannot be sent either.
+  size_t posted_count = 0;
+  for (; posted_count < commands.size(); ++posted_count) {
+    const BatchCommand& command = commands[posted_count];
+    PendingCommand& entry = pending[posted_count];
+    Status status = PostCommand(
+        command.method, *command.params, 0, true, nullptr,
+        base::BindOnce(&StoreCommandOutcome, &entry.is_completed,
+                       &entry.status, static_cast<base::Value*>(nullptr)),
+        &entry.id, &entry.response_info);
+    if (status.IsError()) {
+      for (size_t i = posted_count; i < commands.size(); ++i)
+        pending[i].status = status;
+      break;
+    }
+  }
+
+  // The responses may arrive in any order. Those received while waiting for
+  // an earlier command are already completed. A failed wait, e.g. a timeout
+  // or a broken connection, would fail the same way for the rest of the
+  // commands, so they are abandoned instead of each waiting in turn.
+  for (size_t i = 0; i < posted_count; ++i) {
+    PendingCommand& entry = pending[i];
+    Status status = WaitForCompletion(entry.id, entry.response_info, nullptr,
+                                      &entry.is_completed);
+    if (status.IsOk())
+      continue;
+    entry.status = status;
+    for (size_t j = i + 1; j < posted_count; ++j) {
+      PendingCommand& abandoned = pending[j];
+      if (abandoned.is_completed)
+        continue;
+      abandoned.response_info->callback.Reset();
+      if (abandoned.response_info->state == kReceived)
+        response_infos_.Take(abandoned.id);
+      abandoned.status = status;
+    }
+    break;
+  }
+
+  Status first_error(kOk);
+  if (statuses)
+    statuses->clear();
+  for (const PendingCommand& entry : pending) {
+    if (first_error.IsOk())
+      first_error = entry.status;
+    if (statuses)
+      statuses->push_back(entry.status);
+  }
+  return first_error;
+}
+
 void DevToolsClientImpl::AddListener(DevToolsEventListener* listener) {
   DCHECK(listener);
   DCHECK(!IsConnected() || !listener->ListensToConnections());
@@ -390,7 +572,39 @@ void DevToolsClientImpl::AddListener(DevToolsEventListener* listener) {
         << " subscribing a listener to the already connected DevToolsClient."
         << " Connection notification will not arrive.";
   }
-  listeners_.push_back(listener);
+  listeners_.emplace_back(listener);
+  const base::flat_set<std::string>& methods = listeners_.back().event_methods;
+  if (methods.empty())
+    listens_to_all_events_ = true;
+  else
+    listened_event_methods_.insert(methods.begin(), methods.end());
+}
+
+const DevToolsClientImpl::DispatchStats& DevToolsClientImpl::dispatch_stats()
+    const {
+  return dispatch_stats_;
+}
+
+const CdpMetrics& DevToolsClientImpl::cdp_metrics() const {
+  return metrics_;
+}
+
+base::Value::Dict DevToolsClientImpl::CdpMetricsToValue() const {
+  CdpMetrics total;
+  base::Value::Dict clients;
+  std::vector<const DevToolsClientImpl*> pending = {this};
+  while (!pending.empty()) {
+    const DevToolsClientImpl* client = pending.back();
+    pending.pop_back();
+    total.Merge(client->metrics_);
+    clients.Set(client->id_, client->metrics_.ToValue());
+    for (const auto& child : client->children_)
+      pending.push_back(child.second);
+  }
+  base::Value::Dict dict;
+  dict.Set("total", total.ToValue());
+  dict.Set("clients", std::move(clients));
+  return dict;
 }
 
 Status DevToolsClientImpl::HandleReceivedEvents() {
@@ -455,6 +669,22 @@ DevToolsClientImpl::ResponseInfo::ResponseInfo(const std::string& method)
 
 DevToolsClientImpl::ResponseInfo::~ResponseInfo() {}
 
+DevToolsClientImpl::ListenerInfo::ListenerInfo(DevToolsEventListener* listener)
+    : listener(listener), event_methods(listener->GetListenedEventMethods()) {}
+
+DevToolsClientImpl::ListenerInfo::ListenerInfo(ListenerInfo&& other) = default;
+
+DevToolsClientImpl::ListenerInfo& DevToolsClientImpl::ListenerInfo::operator=(
+    ListenerInfo&& other) = default;
+
+DevToolsClientImpl::ListenerInfo::~ListenerInfo() = default;
+
+bool DevToolsClientImpl::ListenerInfo::ListensToEvent(
+    const std::string& method) const {
+  return event_methods.empty() ||
+         event_methods.find(method) != event_methods.end();
+}
+
 DevToolsClient* DevToolsClientImpl::GetRootClient() {
   return parent_ ? parent_->GetRootClient() : this;
 }
@@ -484,79 +714,132 @@ Status DevToolsClientImpl::SendCommandInternal(
     bool wait_for_response,
     const int client_command_id,
     const Timeout* timeout) {
+  // The synchronous commands are asynchronous commands whose completion is
+  // awaited in place.
+  bool is_completed = false;
+  Status outcome(kOk);
+  ResultCallback callback;
+  if (wait_for_response) {
+    callback =
+        base::BindOnce(&StoreCommandOutcome, &is_completed, &outcome, result);
+  }
+  int command_id;
+  scoped_refptr<ResponseInfo> response_info;
+  Status status =
+      PostCommand(method, params, client_command_id, expect_response, timeout,
+                  std::move(callback), &command_id, &response_info);
+  if (status.IsError())
+    return status;
+
+  if (!expect_response) {
+    CHECK(!wait_for_response);
+    if (result)
+      *result = base::Value(base::Value::Type::DICTIONARY);
+    return Status(kOk);
+  }
+  if (!wait_for_response)
+    return Status(kOk);
+  status = WaitForCompletion(command_id, std::move(response_info), timeout,
+                             &is_completed);
+  if (status.IsError())
+    return status;
+  return outcome;
+}
+
+Status DevToolsClientImpl::PostCommand(
+    const std::string& method,
+    const base::DictionaryValue& params,
+    int client_command_id,
+    bool expect_response,
+    const Timeout* timeout,
+    ResultCallback callback,
+    int* command_id,
+    scoped_refptr<ResponseInfo>* response_info) {
   DCHECK(IsConnected());
   if (parent_ == nullptr && !socket_->IsConnected())
     return Status(kDisconnected, "not connected to DevTools");
 
   // |client_command_id| will be 0 for commands sent by ChromeDriver
-  int command_id = client_command_id ? client_command_id : next_id_++;
-  base::DictionaryValue command;
-  command.SetInteger("id", command_id);
-  command.SetString("method", method);
-  command.SetKey("params", params.Clone());
-  if (!session_id_.empty()) {
-    command.SetString("sessionId", session_id_);
+  *command_id = client_command_id ? client_command_id : next_id_++;
+  if (!internal::SerializeInspectorCommand(*command_id, method, params,
+                                           session_id_, &params_buffer_,
+                                           &message_buffer_)) {
+    return Status(kUnknownError, "unable to serialize command " + method);
   }
-  std::string message = SerializeValue(&command);
 
   if (IsVLogOn(1)) {
     // Note: ChromeDriver log-replay depends on the format of this logging.
     // see chromedriver/log_replay/devtools_log_reader.cc.
-    VLOG(1) << "DevTools WebSocket Command: " << method << " (id=" << command_id
-            << ")" << SessionId(session_id_) << " " << id_ << " "
-            << FormatValueForDisplay(params);
+    VLOG(1) << "DevTools WebSocket Command: " << method
+            << " (id=" << *command_id << ")" << SessionId(session_id_) << " "
+            << id_ << " " << FormatValueForDisplay(params);
   }
   SyncWebSocket* socket =
       static_cast<DevToolsClientImpl*>(GetRootClient())->socket_.get();
-  if (!socket->Send(message)) {
+  if (!socket->Send(message_buffer_)) {
     return Status(kDisconnected, "unable to send message to renderer");
   }
+  metrics_.bytes_sent += message_buffer_.size();
+  ++metrics_.commands[method].sent;
 
   if (expect_response) {
-    scoped_refptr<ResponseInfo> response_info =
-        base::MakeRefCounted<ResponseInfo>(method);
+    *response_info = base::MakeRefCounted<ResponseInfo>(method);
+    (*response_info)->send_time = base::TimeTicks::Now();
     if (timeout)
-      response_info->command_timeout = *timeout;
-    response_info_map_[command_id] = response_info;
-
-    if (wait_for_response) {
-      while (response_info->state == kWaiting) {
-        // Use a long default timeout if user has not requested one.
-        Status status = ProcessNextMessage(
-            command_id, true,
-            timeout != nullptr ? *timeout : Timeout(base::Minutes(10)), this);
-        if (status.IsError()) {
-          if (response_info->state == kReceived)
-            response_info_map_.erase(command_id);
-          return status;
-        }
-      }
-      if (response_info->state == kBlocked) {
-        response_info->state = kIgnored;
-        if (owner_) {
-          std::string alert_text;
-          Status status =
-              owner_->GetJavaScriptDialogManager()->GetDialogMessage(
-                  &alert_text);
-          if (status.IsOk())
-            return Status(kUnexpectedAlertOpen,
-                          "{Alert text : " + alert_text + "}");
-        }
-        return Status(kUnexpectedAlertOpen);
-      }
-      CHECK_EQ(response_info->state, kReceived);
-      internal::InspectorCommandResponse& response = response_info->response;
-      if (!response.result) {
-        return internal::ParseInspectorError(response.error);
+      (*response_info)->command_timeout = *timeout;
+    (*response_info)->callback = std::move(callback);
+    response_infos_.Insert(*command_id, *response_info);
+  }
+  return Status(kOk);
+}
+
+Status DevToolsClientImpl::WaitForCompletion(
+    int command_id,
+    scoped_refptr<ResponseInfo> response_info,
+    const Timeout* timeout,
+    const bool* is_completed) {
+  while (!*is_completed) {
+    // Use a long default timeout if user has not requested one.
+    Status status = ProcessNextMessage(
+        command_id, true,
+        timeout != nullptr ? *timeout : Timeout(base::Minutes(10)), this);
+    if (status.IsError()) {
+      // The waiter is going away, the outcome cannot be delivered anymore.
+      response_info->callback.Reset();
+      if (response_info->state == kReceived)
+        response_infos_.Take(command_id);
+      return status;
+    }
+  }
+  return Status(kOk);
+}
+
+void DevToolsClientImpl::CompleteCommand(ResponseInfo* response_info) {
+  if (!response_info->callback)
+    return;
+  base::Value result;
+  Status status(kOk);
+  if (response_info->state == kBlocked) {
+    response_info->state = kIgnored;
+    status = Status(kUnexpectedAlertOpen);
+    if (owner_) {
+      std::string alert_text;
+      if (owner_->GetJavaScriptDialogManager()
+              ->GetDialogMessage(&alert_text)
+              .IsOk()) {
+        status =
+            Status(kUnexpectedAlertOpen, "{Alert text : " + alert_text + "}");
       }
-      *result = std::move(*response.result);
     }
   } else {
-    CHECK(!wait_for_response);
-    if (result)
-      *result = base::Value(base::Value::Type::DICTIONARY);
+    CHECK_EQ(response_info->state, kReceived);
+    internal::InspectorCommandResponse& response = response_info->response;
+    if (response.result)
+      result = std::move(*response.result);
+    else
+      status = internal::ParseInspectorError(response.error);
   }
-  return Status(kOk);
+  std::move(response_info->callback).Run(status, std::move(result));
 }
 
 Status DevToolsClientImpl::ProcessNextMessage(int expected_id,
@@ -577,11 +860,11 @@ Status DevToolsClientImpl::ProcessNextMessage(int expected_id,
     return status;
 
   // The command response may have already been received (in which case it will
-  // have been deleted from |response_info_map_|) or blocked while notifying
+  // have been deleted from |response_infos_|) or blocked while notifying
   // listeners.
   if (expected_id != -1) {
-    auto iter = response_info_map_.find(expected_id);
-    if (iter == response_info_map_.end() || iter->second->state != kWaiting)
+    ResponseInfo* response_info = response_infos_.Find(expected_id);
+    if (!response_info || response_info->state != kWaiting)
       return Status(kOk);
   }
 
@@ -595,7 +878,12 @@ Status DevToolsClientImpl::ProcessNextMessage(int expected_id,
     return parent_->ProcessNextMessage(-1, log_timeout, timeout, caller);
 
   std::string message;
-  switch (socket_->ReceiveNextMessage(&message, timeout)) {
+  base::TimeTicks receive_start = base::TimeTicks::Now();
+  SyncWebSocket::StatusCode receive_status =
+      socket_->ReceiveNextMessage(&message, timeout);
+  ScopedCdpCallRecorder::RecordBlockedTime(base::TimeTicks::Now() -
+                                           receive_start);
+  switch (receive_status) {
     case SyncWebSocket::StatusCode::kOk:
       break;
     case SyncWebSocket::StatusCode::kDisconnected: {
@@ -622,15 +910,38 @@ Status DevToolsClientImpl::ProcessNextMessage(int expected_id,
 Status DevToolsClientImpl::HandleMessage(int expected_id,
                                          const std::string& message,
                                          DevToolsClientImpl* caller) {
+  ++dispatch_stats_.messages;
+  metrics_.bytes_received += message.size();
+  // Events are never awaited by the pending commands. If nobody is interested
+  // in the event the message can be dropped without a full parse.
+  // Event logging is relied upon by log-replay, hence it disables the filter.
+  if (event_filtering_enabled_ && !IsVLogOn(1)) {
+    std::string method;
+    std::string session_id;
+    if (internal::PeekInspectorEvent(message, &method, &session_id)) {
+      DevToolsClientImpl* client = this;
+      if (session_id != session_id_) {
+        auto it = children_.find(session_id);
+        client = it == children_.end() ? nullptr : it->second;
+      }
+      if (client == nullptr || !client->IsEventOfInterest(method)) {
+        ++dispatch_stats_.skipped_events;
+        return Status(kOk);
+      }
+    }
+  }
+
   std::string session_id;
   internal::InspectorMessageType type;
   internal::InspectorEvent event;
   internal::InspectorCommandResponse response;
+  base::TimeTicks parse_start = base::TimeTicks::Now();
   if (!parser_func_.Run(message, expected_id, &session_id, &type, &event,
                         &response)) {
     LOG(ERROR) << "Bad inspector message: " << message;
     return Status(kUnknownError, "bad inspector message: " + message);
   }
+  metrics_.parse_time.Add(base::TimeTicks::Now() - parse_start);
   DevToolsClientImpl* client = this;
   if (session_id != session_id_) {
     auto it = children_.find(session_id);
@@ -687,6 +998,16 @@ Status DevToolsClientImpl::HandleMessage(int expected_id,
   }
 }
 
+bool DevToolsClientImpl::IsEventOfInterest(const std::string& method) const {
+  // These events are handled by ProcessEvent itself.
+  if (method == "Inspector.detached" || method == "Inspector.targetCrashed" ||
+      method == "Page.javascriptDialogOpening") {
+    return true;
+  }
+  return listens_to_all_events_ ||
+         listened_event_methods_.find(method) != listened_event_methods_.end();
+}
+
 Status DevToolsClientImpl::ProcessEvent(const internal::InspectorEvent& event) {
   if (IsVLogOn(1)) {
     // Note: ChromeDriver log-replay depends on the format of this logging.
@@ -695,9 +1016,13 @@ Status DevToolsClientImpl::ProcessEvent(const internal::InspectorEvent& event) {
             << SessionId(session_id_) << " " << id_ << " "
             << FormatValueForDisplay(*event.params);
   }
-  unnotified_event_listeners_ = listeners_;
+  ++metrics_.events[event.method];
+  next_event_listener_ = 0;
+  event_listeners_end_ = listeners_.size();
   unnotified_event_ = &event;
+  base::TimeTicks dispatch_start = base::TimeTicks::Now();
   Status status = EnsureListenersNotifiedOfEvent();
+  metrics_.dispatch_time.Add(base::TimeTicks::Now() - dispatch_start);
   unnotified_event_ = nullptr;
   if (status.IsError())
     return status;
@@ -721,13 +1046,17 @@ Status DevToolsClientImpl::ProcessEvent(const internal::InspectorEvent& event) {
     base::DictionaryValue enable_params;
     enable_params.SetString("purpose", "detect if alert blocked any cmds");
     Status enable_status = SendCommand("Inspector.enable", enable_params);
-    for (auto iter = response_info_map_.begin();
-         iter != response_info_map_.end(); ++iter) {
-      if (iter->first > max_id)
-        continue;
-      if (iter->second->state == kWaiting)
-        iter->second->state = kBlocked;
-    }
+    std::vector<scoped_refptr<ResponseInfo>> blocked_infos =
+        response_infos_.GetUpTo(max_id);
+    base::EraseIf(blocked_infos, [](const auto& info) {
+      return info->state != kWaiting;
+    });
+    for (const scoped_refptr<ResponseInfo>& blocked_info : blocked_infos)
+      blocked_info->state = kBlocked;
+    // The callbacks may send commands, hence they run once all the blocked
+    // commands are marked.
+    for (const scoped_refptr<ResponseInfo>& blocked_info : blocked_infos)
+      CompleteCommand(blocked_info.get());
     if (enable_status.IsError())
       return status;
   }
@@ -735,12 +1064,13 @@ Status DevToolsClientImpl::ProcessEvent(const internal::InspectorEvent& event) {
 }
 
 Status DevToolsClientImpl::ProcessCommandResponse(
-    const internal::InspectorCommandResponse& response) {
-  auto iter = response_info_map_.find(response.id);
+    internal::InspectorCommandResponse& response) {
+  scoped_refptr<ResponseInfo> response_info =
+      response_infos_.Take(response.id);
   if (IsVLogOn(1)) {
     std::string method, result;
-    if (iter != response_info_map_.end())
-      method = iter->second->method;
+    if (response_info)
+      method = response_info->method;
     if (response.result)
       result = FormatValueForDisplay(*response.result);
     else
@@ -752,7 +1082,7 @@ Status DevToolsClientImpl::ProcessCommandResponse(
             << id_ << " " << result;
   }
 
-  if (iter == response_info_map_.end()) {
+  if (!response_info) {
     // A CDP session may become detached while a command sent to that session
     // is still pending. When the browser eventually tries to process this
     // command, it sends a response with an error and no session ID. Since
@@ -770,34 +1100,45 @@ Status DevToolsClientImpl::ProcessCommandResponse(
     return Status(kUnknownError, "unexpected command response");
   }
 
-  scoped_refptr<ResponseInfo> response_info = response_info_map_[response.id];
-  response_info_map_.erase(response.id);
+  base::TimeDelta round_trip =
+      base::TimeTicks::Now() - response_info->send_time;
+  metrics_.commands[response_info->method].round_trip.Add(round_trip);
+  ScopedCdpCallRecorder::RecordCall(response_info->method, round_trip);
 
+  const bool has_result = !!response.result;
   if (response_info->state != kIgnored) {
     response_info->state = kReceived;
     response_info->response.id = response.id;
-    response_info->response.error = response.error;
-    if (response.result) {
-      response_info->response.result = base::DictionaryValue::From(
-          base::Value::ToUniquePtrValue(response.result->Clone()));
-    }
+    response_info->response.error = std::move(response.error);
   }
-
-  if (response.result) {
-    unnotified_cmd_response_listeners_ = listeners_;
+  // The freshly parsed |response| is not used after this point. Hand its
+  // result over to |response_info| instead of cloning it: both the waiting
+  // caller and the listeners read it from there.
+  response_info->response.result = std::move(response.result);
+
+  Status status(kOk);
+  if (has_result) {
+    next_cmd_response_listener_ = 0;
+    cmd_response_listeners_end_ = listeners_.size();
     unnotified_cmd_response_info_ = response_info;
-    Status status = EnsureListenersNotifiedOfCommandResponse();
+    base::TimeTicks dispatch_start = base::TimeTicks::Now();
+    status = EnsureListenersNotifiedOfCommandResponse();
+    metrics_.dispatch_time.Add(base::TimeTicks::Now() - dispatch_start);
     unnotified_cmd_response_info_.reset();
-    if (status.IsError())
-      return status;
   }
-  return Status(kOk);
+  // The sender learns about the outcome after the listeners, so that it
+  // observes their updated state. A blocked command is already completed.
+  if (response_info->state == kReceived)
+    CompleteCommand(response_info.get());
+  return status;
 }
 
 Status DevToolsClientImpl::EnsureListenersNotifiedOfConnect() {
-  while (unnotified_connect_listeners_.size()) {
-    DevToolsEventListener* listener = unnotified_connect_listeners_.front();
-    unnotified_connect_listeners_.pop_front();
+  while (next_connect_listener_ < connect_listeners_end_) {
+    DevToolsEventListener* listener =
+        listeners_[next_connect_listener_++].listener;
+    if (!listener->ListensToConnections())
+      continue;
     Status status = listener->OnConnected(this);
     if (status.IsError())
       return status;
@@ -807,13 +1148,18 @@ Status DevToolsClientImpl::EnsureListenersNotifiedOfConnect() {
 }
 
 Status DevToolsClientImpl::EnsureListenersNotifiedOfEvent() {
-  while (unnotified_event_listeners_.size()) {
-    DevToolsEventListener* listener = unnotified_event_listeners_.front();
-    unnotified_event_listeners_.pop_front();
-    Status status = listener->OnEvent(
-        this, unnotified_event_->method, *unnotified_event_->params);
+  while (next_event_listener_ < event_listeners_end_) {
+    const ListenerInfo& info = listeners_[next_event_listener_++];
+    // A listener declaring its event methods is not interested in the rest.
+    if (event_filtering_enabled_ &&
+        !info.ListensToEvent(unnotified_event_->method)) {
+      continue;
+    }
+    ++dispatch_stats_.listener_calls;
+    Status status = info.listener->OnEvent(this, unnotified_event_->method,
+                                           *unnotified_event_->params);
     if (status.IsError()) {
-      unnotified_event_listeners_.clear();
+      next_event_listener_ = event_listeners_end_;
       return status;
     }
   }
@@ -821,16 +1167,20 @@ Status DevToolsClientImpl::EnsureListenersNotifiedOfEvent() {
 }
 
 Status DevToolsClientImpl::EnsureListenersNotifiedOfCommandResponse() {
-  while (unnotified_cmd_response_listeners_.size()) {
+  while (next_cmd_response_listener_ < cmd_response_listeners_end_) {
     DevToolsEventListener* listener =
-        unnotified_cmd_response_listeners_.front();
-    unnotified_cmd_response_listeners_.pop_front();
+        listeners_[next_cmd_response_listener_++].listener;
+    ++dispatch_stats_.listener_calls;
     Status status = listener->OnCommandSuccess(
         this, unnotified_cmd_response_info_->method,
         unnotified_cmd_response_info_->response.result.get(),
         unnotified_cmd_response_info_->command_timeout);
-    if (status.IsError())
+    if (status.IsError()) {
+      // |unnotified_cmd_response_info_| is reset once the error is returned,
+      // hence the remaining listeners cannot be notified later.
+      next_cmd_response_listener_ = cmd_response_listeners_end_;
       return status;
+    }
   }
   return Status(kOk);
 }
@@ -845,35 +1195,35 @@ bool ParseInspectorMessage(const std::string& message,
                            InspectorCommandResponse* command_response) {
   // We want to allow invalid characters in case they are valid ECMAScript
   // strings. For example, webplatform tests use this to check string handling
-  std::unique_ptr<base::Value> message_value = base::JSONReader::ReadDeprecated(
-      message, base::JSON_REPLACE_INVALID_CHARACTERS);
-  base::DictionaryValue* message_dict;
-  if (!message_value || !message_value->GetAsDictionary(&message_dict))
+  absl::optional<base::Value> message_value =
+      base::JSONReader::Read(message, base::JSON_REPLACE_INVALID_CHARACTERS);
+  if (!message_value || !message_value->is_dict())
     return false;
+  base::Value::Dict& message_dict = message_value->GetDict();
   session_id->clear();
-  if (const std::string* str = message_dict->FindStringKey("sessionId"))
-    *session_id = *str;
+  if (std::string* str = message_dict.FindString("sessionId"))
+    *session_id = std::move(*str);
 
-  base::Value* id_value = message_dict->FindKey("id");
+  // The parsed root is owned by this function, therefore the "params" and
+  // "result" sub-trees are moved out of it instead of being cloned.
+  // Network and Page events can carry hundreds of kilobytes of payload.
+  const base::Value* id_value = message_dict.Find("id");
   if (!id_value) {
-    std::string method;
-    if (!message_dict->GetString("method", &method))
+    std::string* method = message_dict.FindString("method");
+    if (!method)
       return false;
-    base::DictionaryValue* params = nullptr;
-    message_dict->GetDictionary("params", &params);
 
     *type = kEventMessageType;
-    event->method = method;
-    if (params) {
+    event->method = std::move(*method);
+    absl::optional<base::Value> params = message_dict.Extract("params");
+    if (params && params->is_dict()) {
       event->params = base::DictionaryValue::From(
-          base::Value::ToUniquePtrValue(params->Clone()));
+          base::Value::ToUniquePtrValue(std::move(*params)));
     } else {
       event->params = std::make_unique<base::DictionaryValue>();
     }
     return true;
   } else if (id_value->is_int()) {
-    base::DictionaryValue* unscoped_error = nullptr;
-    base::DictionaryValue* unscoped_result = nullptr;
     *type = kCommandResponseMessageType;
     command_response->id = id_value->GetInt();
     // As per Chromium issue 392577, DevTools does not necessarily return a
@@ -881,11 +1231,15 @@ bool ParseInspectorMessage(const std::string& message,
     // Tracing.start and Tracing.end command responses do not contain one.
     // So, if neither "error" nor "result" keys are present, just provide
     // a blank result dictionary.
-    if (message_dict->GetDictionary("result", &unscoped_result)) {
+    absl::optional<base::Value> result = message_dict.Extract("result");
+    if (result && result->is_dict()) {
       command_response->result = base::DictionaryValue::From(
-          base::Value::ToUniquePtrValue(unscoped_result->Clone()));
-    } else if (message_dict->GetDictionary("error", &unscoped_error)) {
-      base::JSONWriter::Write(*unscoped_error, &command_response->error);
+          base::Value::ToUniquePtrValue(std::move(*result)));
+      return true;
+    }
+    absl::optional<base::Value> error = message_dict.Extract("error");
+    if (error && error->is_dict()) {
+      base::JSONWriter::Write(*error, &command_response->error);
     } else {
       command_response->result = std::make_unique<base::DictionaryValue>();
     }
@@ -894,6 +1248,81 @@ bool ParseInspectorMessage(const std::string& message,
   return false;
 }
 
+bool SerializeInspectorCommand(int command_id,
+                               base::StringPiece method,
+                               const base::DictionaryValue& params,
+                               base::StringPiece session_id,
+                               std::string* params_buffer,
+                               std::string* message) {
+  if (!base::JSONWriter::Write(params, params_buffer))
+    return false;
+  message->clear();
+  message->reserve(params_buffer->size() + method.size() + session_id.size() +
+                   64);
+  message->append("{\"id\":");
+  message->append(base::NumberToString(command_id));
+  message->append(",\"method\":");
+  base::EscapeJSONString(method, true, message);
+  message->append(",\"params\":");
+  message->append(*params_buffer);
+  if (!session_id.empty()) {
+    message->append(",\"sessionId\":");
+    base::EscapeJSONString(session_id, true, message);
+  }
+  message->push_back('}');
+  return true;
+}
+
+bool PeekInspectorEvent(base::StringPiece message,
+                        std::string* method,
+                        std::string* session_id) {
+  size_t pos = 0;
+  bool has_method = false;
+  session_id->clear();
+  SkipWhitespace(message, &pos);
+  if (pos >= message.size() || message[pos] != '{')
+    return false;
+  ++pos;
+  while (true) {
+    SkipWhitespace(message, &pos);
+    base::StringPiece key;
+    if (!ScanSimpleString(message, &pos, &key))
+      return false;
+    SkipWhitespace(message, &pos);
+    if (pos >= message.size() || message[pos] != ':')
+      return false;
+    ++pos;
+    SkipWhitespace(message, &pos);
+    if (key == "id") {
+      // This is a command response.
+      return false;
+    } else if (key == "method" || key == "sessionId") {
+      base::StringPiece value;
+      if (!ScanSimpleString(message, &pos, &value))
+        return false;
+      if (key == "method") {
+        *method = std::string(value);
+        has_method = true;
+      } else {
+        *session_id = std::string(value);
+      }
+    } else if (!SkipValue(message, &pos)) {
+      return false;
+    }
+    SkipWhitespace(message, &pos);
+    if (pos >= message.size())
+      return false;
+    if (message[pos] == '}')
+      break;
+    if (message[pos] != ',')
+      return false;
+    ++pos;
+  }
+  ++pos;
+  SkipWhitespace(message, &pos);
+  return has_method && pos == message.size();
+}
+
 Status ParseInspectorError(const std::string& error_json) {
   std::unique_ptr<base::Value> error =
       base::JSONReader::ReadDeprecated(error_json);
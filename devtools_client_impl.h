@@ -5,15 +5,26 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_CHROME_DEVTOOLS_CLIENT_IMPL_H_
 #define CHROME_TEST_CHROMEDRIVER_CHROME_DEVTOOLS_CLIENT_IMPL_H_
 
-#include <list>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "base/callback.h"
+#include "base/containers/flat_set.h"
 #include "base/memory/raw_ptr.h"
 #include "base/memory/ref_counted.h"
 #include "base/memory/scoped_refptr.h"
+#include "base/strings/string_piece.h"
+#include "base/time/time.h"
+#include "base/values.h"
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
 #include "chrome/test/chromedriver/chrome/devtools_client.h"
 #include "chrome/test/chromedriver/net/sync_websocket_factory.h"
 #include "chrome/test/chromedriver/net/timeout.h"
@@ -45,6 +56,104 @@ struct InspectorCommandResponse {
   std::unique_ptr<base::DictionaryValue> result;
 };
 
+// Pending commands indexed by their id. ChromeDriver allocates the ids
+// sequentially, hence the in-flight ones map to distinct slots of a fixed
+// array, which makes the insertion and the lookup allocation free. The id
+// stored in a slot tells whether the slot belongs to the looked up command.
+// Colliding ids, e.g. provided by a BiDi client or exceeding the number of
+// slots in flight, are kept in a map.
+template <typename Command>
+class PendingCommandTable {
+ public:
+  PendingCommandTable() = default;
+  PendingCommandTable(const PendingCommandTable&) = delete;
+  PendingCommandTable& operator=(const PendingCommandTable&) = delete;
+  ~PendingCommandTable() = default;
+
+  void Insert(int id, scoped_refptr<Command> command) {
+    Slot& slot = SlotFor(id);
+    if (!slot.command || slot.id == id) {
+      slot.id = id;
+      slot.command = std::move(command);
+      // Keep a single entry per id.
+      if (!overflow_.empty())
+        overflow_.erase(id);
+    } else {
+      overflow_[id] = std::move(command);
+    }
+  }
+
+  // Returns nullptr if there is no command |id|.
+  Command* Find(int id) const {
+    const Slot& slot = SlotFor(id);
+    if (slot.command && slot.id == id)
+      return slot.command.get();
+    if (overflow_.empty())
+      return nullptr;
+    auto it = overflow_.find(id);
+    return it == overflow_.end() ? nullptr : it->second.get();
+  }
+
+  // Removes the command |id| and returns it, or nullptr if there is none.
+  scoped_refptr<Command> Take(int id) {
+    Slot& slot = SlotFor(id);
+    if (slot.command && slot.id == id)
+      return std::move(slot.command);
+    scoped_refptr<Command> command;
+    auto it = overflow_.find(id);
+    if (it != overflow_.end()) {
+      command = std::move(it->second);
+      overflow_.erase(it);
+    }
+    return command;
+  }
+
+  void Clear() {
+    for (Slot& slot : slots_)
+      slot.command.reset();
+    overflow_.clear();
+  }
+
+  // Returns the pending commands with id not exceeding |max_id|, ordered by
+  // id.
+  std::vector<scoped_refptr<Command>> GetUpTo(int max_id) const {
+    std::vector<std::pair<int, scoped_refptr<Command>>> matching;
+    for (const Slot& slot : slots_) {
+      if (slot.command && slot.id <= max_id)
+        matching.emplace_back(slot.id, slot.command);
+    }
+    for (const auto& [id, command] : overflow_) {
+      if (id <= max_id)
+        matching.emplace_back(id, command);
+    }
+    std::sort(matching.begin(), matching.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+              });
+    std::vector<scoped_refptr<Command>> commands;
+    commands.reserve(matching.size());
+    for (auto& [id, command] : matching)
+      commands.push_back(std::move(command));
+    return commands;
+  }
+
+ private:
+  static constexpr size_t kSlotCount = 64;
+  struct Slot {
+    int id = 0;
+    scoped_refptr<Command> command;
+  };
+  Slot& SlotFor(int id) {
+    return slots_[static_cast<unsigned>(id) % kSlotCount];
+  }
+  const Slot& SlotFor(int id) const {
+    return slots_[static_cast<unsigned>(id) % kSlotCount];
+  }
+
+  std::array<Slot, kSlotCount> slots_;
+  std::map<int, scoped_refptr<Command>> overflow_;
+};
+
 }  // namespace internal
 
 class DevToolsEventListener;
@@ -136,6 +245,11 @@ class DevToolsClientImpl : public DevToolsClient {
   Status SendCommandAndIgnoreResponse(
       const std::string& method,
       const base::DictionaryValue& params) override;
+  Status SendCommandAndGetResultAsync(const std::string& method,
+                                      const base::DictionaryValue& params,
+                                      ResultCallback callback) override;
+  Status SendCommandBatch(const std::vector<BatchCommand>& commands,
+                          std::vector<Status>* statuses) override;
 
   // Add a listener for connection and events.
   // Listeners cannot be added to the object that is already connected.
@@ -154,6 +268,26 @@ class DevToolsClientImpl : public DevToolsClient {
   void SetMainPage(bool value);
   int NextMessageId() const;
 
+  // Counters of the work spent on dispatching the incoming messages.
+  // |messages| and |skipped_events| are only counted by the root client,
+  // which receives all the messages. |listener_calls| are counted by the
+  // client whose listeners are invoked.
+  struct DispatchStats {
+    int64_t messages = 0;
+    // Events dropped before parsing because nobody was interested in them.
+    int64_t skipped_events = 0;
+    // Invocations of DevToolsEventListener::OnEvent and OnCommandSuccess.
+    int64_t listener_calls = 0;
+  };
+  const DispatchStats& dispatch_stats() const;
+
+  // Wire-level metrics of this client alone. The bytes received and the parse
+  // time are accounted to the root client, which receives all the messages.
+  const CdpMetrics& cdp_metrics() const;
+  // Returns {"total": <metrics>, "clients": {<id>: <metrics>}} covering this
+  // client and its descendants.
+  base::Value::Dict CdpMetricsToValue() const;
+
  private:
   enum ResponseState {
     // The client is waiting for the response.
@@ -174,6 +308,9 @@ class DevToolsClientImpl : public DevToolsClient {
     std::string method;
     internal::InspectorCommandResponse response;
     Timeout command_timeout;
+    base::TimeTicks send_time;
+    // Runs once the command leaves the kWaiting state.
+    ResultCallback callback;
 
    private:
     friend class base::RefCounted<ResponseInfo>;
@@ -186,6 +323,26 @@ class DevToolsClientImpl : public DevToolsClient {
                              bool wait_for_response,
                              int client_command_id,
                              const Timeout* timeout);
+  // Writes the command to the socket. If |expect_response| the command is
+  // registered in |response_infos_| together with |callback| and
+  // |*response_info| is set.
+  Status PostCommand(const std::string& method,
+                     const base::DictionaryValue& params,
+                     int client_command_id,
+                     bool expect_response,
+                     const Timeout* timeout,
+                     ResultCallback callback,
+                     int* command_id,
+                     scoped_refptr<ResponseInfo>* response_info);
+  // Processes the incoming messages until the completion callback of the
+  // command |command_id| sets |*is_completed|. On error the callback is
+  // dropped.
+  Status WaitForCompletion(int command_id,
+                           scoped_refptr<ResponseInfo> response_info,
+                           const Timeout* timeout,
+                           const bool* is_completed);
+  // Runs the completion callback of a received or blocked command, if any.
+  void CompleteCommand(ResponseInfo* response_info);
   Status ProcessNextMessage(int expected_id,
                             bool log_timeout,
                             const Timeout& timeout,
@@ -193,9 +350,12 @@ class DevToolsClientImpl : public DevToolsClient {
   Status HandleMessage(int expected_id,
                        const std::string& message,
                        DevToolsClientImpl* caller);
+  // Returns true if the event |method| has to be parsed and dispatched, that
+  // is if it is handled by this client itself or by any of its listeners.
+  bool IsEventOfInterest(const std::string& method) const;
   Status ProcessEvent(const internal::InspectorEvent& event);
-  Status ProcessCommandResponse(
-      const internal::InspectorCommandResponse& response);
+  // Takes the result out of |response| rather than copying it.
+  Status ProcessCommandResponse(internal::InspectorCommandResponse& response);
   Status EnsureListenersNotifiedOfConnect();
   Status EnsureListenersNotifiedOfEvent();
   Status EnsureListenersNotifiedOfCommandResponse();
@@ -212,7 +372,7 @@ class DevToolsClientImpl : public DevToolsClient {
   // deep. children_ holds child sessions - identified by their session id -
   // which send/receive messages via the socket_ of their parent.
   raw_ptr<DevToolsClientImpl> parent_;
-  std::map<std::string, DevToolsClientImpl*> children_;
+  std::unordered_map<std::string, DevToolsClientImpl*> children_;
   bool crashed_;
   bool detached_;
   // For the top-level session, this is the target id.
@@ -220,13 +380,44 @@ class DevToolsClientImpl : public DevToolsClient {
   const std::string id_;
   FrontendCloserFunc frontend_closer_func_;
   ParserFunc parser_func_;
-  std::list<DevToolsEventListener*> listeners_;
-  std::list<DevToolsEventListener*> unnotified_connect_listeners_;
-  std::list<DevToolsEventListener*> unnotified_event_listeners_;
+  struct ListenerInfo {
+    explicit ListenerInfo(DevToolsEventListener* listener);
+    ListenerInfo(ListenerInfo&& other);
+    ListenerInfo& operator=(ListenerInfo&& other);
+    ~ListenerInfo();
+
+    // Whether the listener receives |method| events.
+    bool ListensToEvent(const std::string& method) const;
+
+    raw_ptr<DevToolsEventListener> listener;
+    // Empty if the listener receives all events.
+    base::flat_set<std::string> event_methods;
+  };
+  // Listeners are never removed, therefore an index into |listeners_| stays
+  // valid. The pending notifications are tracked as [next, end) index ranges
+  // rather than as copies of the listener list.
+  std::vector<ListenerInfo> listeners_;
+  // Union of the event methods declared by |listeners_|. Unused if any of the
+  // listeners wants all events.
+  base::flat_set<std::string> listened_event_methods_;
+  bool listens_to_all_events_;
+  // Whether events can be dropped before parsing if nobody listens to them.
+  // Disabled when a custom parser is installed for testing.
+  bool event_filtering_enabled_;
+  size_t next_connect_listener_;
+  size_t connect_listeners_end_;
+  size_t next_event_listener_;
+  size_t event_listeners_end_;
   raw_ptr<const internal::InspectorEvent> unnotified_event_;
-  std::list<DevToolsEventListener*> unnotified_cmd_response_listeners_;
+  size_t next_cmd_response_listener_;
+  size_t cmd_response_listeners_end_;
   scoped_refptr<ResponseInfo> unnotified_cmd_response_info_;
-  std::map<int, scoped_refptr<ResponseInfo>> response_info_map_;
+  DispatchStats dispatch_stats_;
+  CdpMetrics metrics_;
+  internal::PendingCommandTable<ResponseInfo> response_infos_;
+  // Buffers reused by every outgoing command to avoid reallocations.
+  std::string params_buffer_;
+  std::string message_buffer_;
   int next_id_;  // The id identifying a particular request.
   int stack_count_;
   bool is_remote_end_configured_;
@@ -243,6 +434,27 @@ bool ParseInspectorMessage(const std::string& message,
                            InspectorEvent* event,
                            InspectorCommandResponse* command_response);
 
+// Writes the command envelope
+// {"id":...,"method":...,"params":...,"sessionId":...} into |message|.
+// |params| are serialized in place, without being copied into an intermediate
+// dictionary. The buffers keep their capacity between calls. Returns false if
+// |params| cannot be serialized.
+bool SerializeInspectorCommand(int command_id,
+                               base::StringPiece method,
+                               const base::DictionaryValue& params,
+                               base::StringPiece session_id,
+                               std::string* params_buffer,
+                               std::string* message);
+
+// Cheaply extracts "method" and "sessionId" from an event message without
+// building a value tree. Returns false if |message| is not a well formed event
+// or if the fast path cannot handle it, e.g. because of escape sequences in
+// the values of interest. In that case the message must be parsed with
+// ParseInspectorMessage.
+bool PeekInspectorEvent(base::StringPiece message,
+                        std::string* method,
+                        std::string* session_id);
+
 Status ParseInspectorError(const std::string& error_json);
 
 }  // namespace internal
@@ -5,17 +5,25 @@
 #include "chrome/test/chromedriver/chrome/devtools_client_impl.h"
 
 #include <list>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/compiler_specific.h"
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
 #include "base/memory/raw_ptr.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/scoped_refptr.h"
+#include "base/process/process_metrics.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/stringprintf.h"
+#include "base/threading/platform_thread.h"
 #include "base/time/time.h"
 #include "base/values.h"
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
 #include "chrome/test/chromedriver/chrome/devtools_event_listener.h"
 #include "chrome/test/chromedriver/chrome/status.h"
 #include "chrome/test/chromedriver/net/sync_websocket.h"
@@ -678,6 +686,330 @@ TEST(ParseInspectorMessage, Command) {
   ASSERT_EQ(1, key);
 }
 
+TEST(ParseInspectorMessage, CommandResultNotDictWithError) {
+  internal::InspectorMessageType type;
+  internal::InspectorEvent event;
+  internal::InspectorCommandResponse response;
+  std::string session_id;
+  ASSERT_TRUE(internal::ParseInspectorMessage(
+      "{\"id\":1,\"result\":1,\"error\":{\"code\":-32000}}", 0,
+      &session_id, &type, &event, &response));
+  ASSERT_EQ(internal::kCommandResponseMessageType, type);
+  ASSERT_EQ(1, response.id);
+  ASSERT_FALSE(response.result);
+  EXPECT_EQ("{\"code\":-32000}", response.error);
+}
+
+namespace {
+
+size_t GetMallocUsage() {
+  return base::ProcessMetrics::CreateCurrentProcessMetrics()->GetMallocUsage();
+}
+
+// Returns a dictionary of about 280 KB, the size of the params of the Network
+// and Page events logged by the performance log.
+base::Value::Dict CreateLargeParams() {
+  base::Value::List entries;
+  for (int i = 0; i < 1000; ++i) {
+    base::Value::Dict entry;
+    entry.Set("index", i);
+    entry.Set("data", std::string(256, 'x'));
+    entries.Append(std::move(entry));
+  }
+  base::Value::Dict params;
+  params.Set("entries", std::move(entries));
+  return params;
+}
+
+}  // namespace
+
+TEST(ParseInspectorMessage, EventWithLargeParams) {
+  base::Value::Dict message_dict;
+  message_dict.Set("method", "Network.dataReceived");
+  message_dict.Set("params", CreateLargeParams());
+  message_dict.Set("sessionId", "AB3A");
+  std::string message;
+  ASSERT_TRUE(base::JSONWriter::Write(base::Value(std::move(message_dict)),
+                                      &message));
+
+  internal::InspectorMessageType type;
+  internal::InspectorEvent event;
+  internal::InspectorCommandResponse response;
+  std::string session_id;
+  ASSERT_TRUE(internal::ParseInspectorMessage(message, 0, &session_id, &type,
+                                              &event, &response));
+  ASSERT_EQ(internal::kEventMessageType, type);
+  EXPECT_EQ("Network.dataReceived", event.method);
+  EXPECT_EQ("AB3A", session_id);
+  const base::Value::List* parsed_entries =
+      event.params->GetDict().FindList("entries");
+  ASSERT_TRUE(parsed_entries);
+  ASSERT_EQ(1000u, parsed_entries->size());
+  const base::Value::Dict* last = (*parsed_entries)[999].GetIfDict();
+  ASSERT_TRUE(last);
+  EXPECT_EQ(999, last->FindInt("index").value_or(-1));
+  const std::string* data = last->FindString("data");
+  ASSERT_TRUE(data);
+  EXPECT_EQ(256u, data->size());
+}
+
+namespace {
+
+// Returns the heap bytes allocated to parse |message| the way it used to be:
+// the sub-tree of an event was cloned out of the parsed root, and the one of a
+// command response was cloned again into the pending command.
+size_t ParseByCloning(const std::string& message) {
+  size_t malloc_usage = GetMallocUsage();
+  std::unique_ptr<base::Value> root = base::JSONReader::ReadDeprecated(
+      message, base::JSON_REPLACE_INVALID_CHARACTERS);
+  EXPECT_TRUE(root && root->is_dict());
+  if (!root || !root->is_dict())
+    return 0;
+  if (const base::Value::Dict* params = root->GetDict().FindDict("params")) {
+    base::Value event_params(params->Clone());
+    return GetMallocUsage() - malloc_usage;
+  }
+  const base::Value::Dict* result = root->GetDict().FindDict("result");
+  EXPECT_TRUE(result);
+  if (!result)
+    return 0;
+  base::Value response_result(result->Clone());
+  base::Value pending_command_result(response_result.Clone());
+  return GetMallocUsage() - malloc_usage;
+}
+
+// Returns the heap bytes allocated to parse |message| with
+// ParseInspectorMessage and to hand its result over to the pending command,
+// less the envelope of the message that is freed on the way.
+size_t ParseByMoving(const std::string& message) {
+  size_t malloc_usage = GetMallocUsage();
+  internal::InspectorMessageType type;
+  internal::InspectorEvent event;
+  internal::InspectorCommandResponse response;
+  std::string session_id;
+  EXPECT_TRUE(internal::ParseInspectorMessage(message, 0, &session_id, &type,
+                                              &event, &response));
+  std::unique_ptr<base::DictionaryValue> pending_command_result =
+      std::move(response.result);
+  return GetMallocUsage() - malloc_usage;
+}
+
+}  // namespace
+
+// The params of large events and the results of large command responses are
+// moved out of the parsed message instead of being cloned, hence parsing them
+// allocates about the size of the parsed message once instead of two or three
+// times. The bytes are recorded as <message>_cloning_bytes and
+// <message>_moving_bytes test properties.
+TEST(ParseInspectorMessage, LargeMessagesAreNotCopied) {
+  if (!GetMallocUsage())
+    GTEST_SKIP() << "The malloc usage is not available";
+  base::Value::Dict event_dict;
+  event_dict.Set("method", "Network.dataReceived");
+  event_dict.Set("params", CreateLargeParams());
+  event_dict.Set("sessionId", "AB3A");
+  std::string event;
+  ASSERT_TRUE(
+      base::JSONWriter::Write(base::Value(std::move(event_dict)), &event));
+  base::Value::Dict response_dict;
+  response_dict.Set("id", 1);
+  response_dict.Set("result", CreateLargeParams());
+  std::string response;
+  ASSERT_TRUE(base::JSONWriter::Write(base::Value(std::move(response_dict)),
+                                      &response));
+
+  const struct {
+    const char* name;
+    const std::string* message;
+  } messages[] = {{"event", &event}, {"command_response", &response}};
+  for (const auto& message : messages) {
+    size_t cloning_bytes = ParseByCloning(*message.message);
+    size_t moving_bytes = ParseByMoving(*message.message);
+    testing::Test::RecordProperty(std::string(message.name) + "_cloning_bytes",
+                                  base::NumberToString(cloning_bytes));
+    testing::Test::RecordProperty(std::string(message.name) + "_moving_bytes",
+                                  base::NumberToString(moving_bytes));
+    // Cloning allocates at least twice the parsed message.
+    EXPECT_LT(moving_bytes * 3 / 2, cloning_bytes) << message.name;
+  }
+}
+
+TEST(PeekInspectorEvent, Event) {
+  std::string method;
+  std::string session_id;
+  ASSERT_TRUE(internal::PeekInspectorEvent(
+      "{\"method\":\"Network.dataReceived\",\"params\":{\"a\":[1,{\"b\":"
+      "\"}\\\"]\"}],\"c\":null,\"d\":-1.5e3},\"sessionId\":\"AB3A\"}",
+      &method, &session_id));
+  EXPECT_EQ("Network.dataReceived", method);
+  EXPECT_EQ("AB3A", session_id);
+}
+
+TEST(PeekInspectorEvent, EventWithWhitespaceAndNoSessionId) {
+  std::string method;
+  std::string session_id = "stale";
+  ASSERT_TRUE(internal::PeekInspectorEvent(
+      " { \"params\" : { } , \"method\" : \"Page.loadEventFired\" } ", &method,
+      &session_id));
+  EXPECT_EQ("Page.loadEventFired", method);
+  EXPECT_TRUE(session_id.empty());
+}
+
+TEST(PeekInspectorEvent, NotAnEvent) {
+  std::string method;
+  std::string session_id;
+  EXPECT_FALSE(internal::PeekInspectorEvent("hi", &method, &session_id));
+  EXPECT_FALSE(internal::PeekInspectorEvent("{}", &method, &session_id));
+  EXPECT_FALSE(internal::PeekInspectorEvent(
+      "{\"id\":1,\"result\":{}}", &method, &session_id));
+  EXPECT_FALSE(internal::PeekInspectorEvent(
+      "{\"method\":\"a\",\"id\":1}", &method, &session_id));
+  EXPECT_FALSE(internal::PeekInspectorEvent(
+      "{\"method\":\"a\",\"params\":{}", &method, &session_id));
+  EXPECT_FALSE(internal::PeekInspectorEvent("{\"method\":\"a\"} x", &method,
+                                            &session_id));
+  // Escape sequences in the values of interest are left to the full parser.
+  EXPECT_FALSE(internal::PeekInspectorEvent("{\"method\":\"a\\u0062\"}",
+                                            &method, &session_id));
+}
+
+TEST(SerializeInspectorCommand, MatchesDictionarySerialization) {
+  base::DictionaryValue mouse_params;
+  mouse_params.GetDict().Set("type", "mouseMoved");
+  mouse_params.GetDict().Set("x", 10.5);
+  mouse_params.GetDict().Set("y", 20);
+  mouse_params.GetDict().Set("modifiers", 0);
+  base::DictionaryValue evaluate_params;
+  evaluate_params.GetDict().Set("expression", "\"quoted\"\n\\ \u2603");
+  evaluate_params.GetDict().Set("returnByValue", true);
+  base::DictionaryValue empty_params;
+
+  struct {
+    const char* method;
+    const base::DictionaryValue* params;
+    const char* session_id;
+  } commands[] = {
+      {"Input.dispatchMouseEvent", &mouse_params, "AB3A"},
+      {"Runtime.evaluate", &evaluate_params, ""},
+      {"Page.enable", &empty_params, "weird\"session"},
+  };
+  std::string params_buffer;
+  std::string message;
+  int id = 1;
+  for (const auto& command : commands) {
+    ASSERT_TRUE(internal::SerializeInspectorCommand(
+        id, command.method, *command.params, command.session_id,
+        &params_buffer, &message));
+    absl::optional<base::Value> parsed = base::JSONReader::Read(message);
+    ASSERT_TRUE(parsed && parsed->is_dict()) << message;
+    const base::Value::Dict& dict = parsed->GetDict();
+    EXPECT_EQ(id, dict.FindInt("id").value_or(-1));
+    const std::string* method = dict.FindString("method");
+    ASSERT_TRUE(method);
+    EXPECT_EQ(command.method, *method);
+    const base::Value::Dict* params = dict.FindDict("params");
+    ASSERT_TRUE(params);
+    EXPECT_EQ(command.params->GetDict(), *params);
+    const std::string* session_id = dict.FindString("sessionId");
+    if (*command.session_id) {
+      ASSERT_TRUE(session_id);
+      EXPECT_EQ(command.session_id, *session_id);
+    } else {
+      EXPECT_FALSE(session_id);
+    }
+    ++id;
+  }
+}
+
+namespace {
+
+struct InspectorCommand {
+  std::string method;
+  base::DictionaryValue params;
+};
+
+// Returns the commands sent while performing a pointer drag: mostly mouse
+// events, an atom call and a node lookup.
+std::vector<InspectorCommand> CreateCommandMix() {
+  std::vector<InspectorCommand> commands(102);
+  for (int i = 0; i < 100; ++i) {
+    commands[i].method = "Input.dispatchMouseEvent";
+    base::Value::Dict& params = commands[i].params.GetDict();
+    params.Set("type", "mouseMoved");
+    params.Set("x", 10.5 + i);
+    params.Set("y", 20);
+    params.Set("modifiers", 0);
+    params.Set("button", "left");
+    params.Set("buttons", 1);
+    params.Set("clickCount", 0);
+  }
+  commands[100].method = "Runtime.callFunctionOn";
+  commands[100].params.GetDict().Set("functionDeclaration",
+                                     std::string(20000, 'f'));
+  commands[100].params.GetDict().Set("returnByValue", true);
+  commands[101].method = "DOM.describeNode";
+  commands[101].params.GetDict().Set("backendNodeId", 42);
+  return commands;
+}
+
+// Returns the heap bytes of the copies made to serialize |commands| the way
+// PostCommand used to: the params were cloned into a command dictionary which
+// was then serialized.
+size_t SerializeByCloning(const std::vector<InspectorCommand>& commands) {
+  std::vector<base::DictionaryValue> dicts(commands.size());
+  size_t malloc_usage = GetMallocUsage();
+  int id = 1;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    base::Value::Dict& dict = dicts[i].GetDict();
+    dict.Set("id", id++);
+    dict.Set("method", commands[i].method);
+    dict.Set("params", commands[i].params.GetDict().Clone());
+    dict.Set("sessionId", "AB3A");
+    std::string message;
+    EXPECT_TRUE(base::JSONWriter::Write(dicts[i], &message));
+  }
+  return GetMallocUsage() - malloc_usage;
+}
+
+// Returns the heap bytes allocated to serialize |commands| with
+// SerializeInspectorCommand into |params_buffer| and |message|.
+size_t SerializeInPlace(const std::vector<InspectorCommand>& commands,
+                        std::string* params_buffer,
+                        std::string* message) {
+  size_t malloc_usage = GetMallocUsage();
+  int id = 1;
+  for (const InspectorCommand& command : commands) {
+    EXPECT_TRUE(internal::SerializeInspectorCommand(
+        id++, command.method, command.params, "AB3A", params_buffer, message));
+  }
+  return GetMallocUsage() - malloc_usage;
+}
+
+}  // namespace
+
+// The params of the commands are serialized in place into buffers reused
+// across commands, instead of being copied into a command dictionary. The
+// bytes are recorded as the cloning_bytes and in_place_bytes test properties.
+TEST(SerializeInspectorCommand, CommandMixIsNotCopied) {
+  if (!GetMallocUsage())
+    GTEST_SKIP() << "The malloc usage is not available";
+  std::vector<InspectorCommand> commands = CreateCommandMix();
+  std::string params_buffer;
+  std::string message;
+  // The buffers grow to the largest command once.
+  SerializeInPlace(commands, &params_buffer, &message);
+
+  size_t cloning_bytes = SerializeByCloning(commands);
+  size_t in_place_bytes = SerializeInPlace(commands, &params_buffer, &message);
+  testing::Test::RecordProperty("cloning_bytes",
+                                base::NumberToString(cloning_bytes));
+  testing::Test::RecordProperty("in_place_bytes",
+                                base::NumberToString(in_place_bytes));
+  // The 20 KB function alone is copied by cloning.
+  EXPECT_LT(20000u, cloning_bytes);
+  EXPECT_LT(in_place_bytes, cloning_bytes / 10);
+}
+
 TEST(ParseInspectorError, EmptyError) {
   Status status = internal::ParseInspectorError("");
   ASSERT_EQ(kUnknownError, status.code());
@@ -1365,3 +1697,441 @@ TEST_F(DevToolsClientImplTest, SendCommandAndIgnoreResponse) {
   ASSERT_EQ(kOk, client.SendCommandAndIgnoreResponse("method", params).code());
   ASSERT_EQ(kOk, client.SendCommand("method", params).code());
 }
+
+namespace {
+
+class MethodFilteringListener : public DevToolsEventListener {
+ public:
+  MethodFilteringListener() = default;
+  ~MethodFilteringListener() override = default;
+
+  base::flat_set<std::string> GetListenedEventMethods() const override {
+    return {"Interesting.event"};
+  }
+
+  Status OnEvent(DevToolsClient* client,
+                 const std::string& method,
+                 const base::DictionaryValue& params) override {
+    methods_.push_back(method);
+    return Status(kOk);
+  }
+
+  std::list<std::string> methods_;
+};
+
+}  // namespace
+
+TEST_F(DevToolsClientImplTest, SkipsEventsNobodyListensTo) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  MethodFilteringListener listener;
+  client.AddListener(&listener);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  // The malformed params would make the message fail to parse if the event
+  // were not dropped beforehand.
+  msgs.push_back("{\"method\": \"Boring.event\", \"params\": {\"a\": nul}}");
+  msgs.push_back("{\"method\": \"Interesting.event\", \"params\": {}}");
+  ASSERT_EQ(kOk, client.HandleReceivedEvents().code());
+  ASSERT_EQ(1u, listener.methods_.size());
+  EXPECT_EQ("Interesting.event", listener.methods_.front());
+}
+
+TEST_F(DevToolsClientImplTest, DeliversAllEventsToDefaultListeners) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  MethodFilteringListener filtering_listener;
+  MockCommandListener all_events_listener;
+  client.AddListener(&filtering_listener);
+  client.AddListener(&all_events_listener);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  msgs.push_back("{\"method\": \"Boring.event\", \"params\": {}}");
+  ASSERT_EQ(kOk, client.HandleReceivedEvents().code());
+  ASSERT_EQ(1u, all_events_listener.msgs_.size());
+  EXPECT_EQ("Boring.event", all_events_listener.msgs_.front());
+}
+
+TEST_F(DevToolsClientImplTest, DeliversEventsOnlyToInterestedListeners) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  MethodFilteringListener filtering_listener;
+  MockCommandListener all_events_listener;
+  client.AddListener(&filtering_listener);
+  client.AddListener(&all_events_listener);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  const DevToolsClientImpl::DispatchStats before = client.dispatch_stats();
+  msgs.push_back("{\"method\": \"Boring.event\", \"params\": {}}");
+  msgs.push_back("{\"method\": \"Interesting.event\", \"params\": {}}");
+  ASSERT_EQ(kOk, client.HandleReceivedEvents().code());
+  ASSERT_EQ(1u, filtering_listener.methods_.size());
+  EXPECT_EQ("Interesting.event", filtering_listener.methods_.front());
+  EXPECT_EQ(2u, all_events_listener.msgs_.size());
+  const DevToolsClientImpl::DispatchStats& after = client.dispatch_stats();
+  EXPECT_EQ(2, after.messages - before.messages);
+  EXPECT_EQ(0, after.skipped_events - before.skipped_events);
+  EXPECT_EQ(3, after.listener_calls - before.listener_calls);
+}
+
+TEST_F(DevToolsClientImplTest, CountsSkippedEvents) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  MethodFilteringListener listener;
+  client.AddListener(&listener);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  const DevToolsClientImpl::DispatchStats before = client.dispatch_stats();
+  msgs.push_back("{\"method\": \"Boring.event\", \"params\": {}}");
+  ASSERT_EQ(kOk, client.HandleReceivedEvents().code());
+  const DevToolsClientImpl::DispatchStats& after = client.dispatch_stats();
+  EXPECT_EQ(1, after.messages - before.messages);
+  EXPECT_EQ(1, after.skipped_events - before.skipped_events);
+  EXPECT_EQ(0, after.listener_calls - before.listener_calls);
+}
+
+TEST_F(DevToolsClientImplTest, CollectsCdpMetrics) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  MockCommandListener listener;
+  client.AddListener(&listener);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  const CdpMetrics before = client.cdp_metrics();
+  msgs.push_back("{\"method\": \"Some.event\", \"params\": {}}");
+  msgs.push_back((std::stringstream() << "{\"id\": " << client.NextMessageId()
+                                      << ", \"result\": {}}")
+                     .str());
+  size_t bytes_received = msgs.front().size() + msgs.back().size();
+  base::DictionaryValue params;
+  ASSERT_EQ(kOk, client.SendCommand("Some.command", params).code());
+
+  const CdpMetrics& after = client.cdp_metrics();
+  EXPECT_EQ(static_cast<int64_t>(bytes_received),
+            after.bytes_received - before.bytes_received);
+  EXPECT_LT(before.bytes_sent, after.bytes_sent);
+  EXPECT_EQ(2, after.parse_time.count() - before.parse_time.count());
+  auto command = after.commands.find("Some.command");
+  ASSERT_NE(after.commands.end(), command);
+  EXPECT_EQ(1, command->second.sent);
+  EXPECT_EQ(1, command->second.round_trip.count());
+  auto event = after.events.find("Some.event");
+  ASSERT_NE(after.events.end(), event);
+  EXPECT_EQ(1, event->second);
+
+  base::Value::Dict value = client.CdpMetricsToValue();
+  EXPECT_TRUE(value.FindDict("total"));
+  const base::Value::Dict* clients = value.FindDict("clients");
+  ASSERT_TRUE(clients);
+  EXPECT_TRUE(clients->FindDict("id"));
+}
+
+TEST_F(DevToolsClientImplTest, SendCommandBatch) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  int first_id = client.NextMessageId();
+  // The responses arrive in reverse order.
+  msgs.push_back((std::stringstream()
+                  << "{\"id\": " << first_id + 1 << ", \"result\": {}}")
+                     .str());
+  msgs.push_back((std::stringstream()
+                  << "{\"id\": " << first_id
+                  << ", \"error\": {\"code\": -32601, \"message\": \"x\"}}")
+                     .str());
+  base::DictionaryValue params;
+  std::vector<Status> statuses;
+  Status status =
+      client.SendCommandBatch({{"first", &params}, {"second", &params}},
+                              &statuses);
+  EXPECT_EQ(kUnknownCommand, status.code());
+  ASSERT_EQ(2u, statuses.size());
+  EXPECT_EQ(kUnknownCommand, statuses[0].code());
+  EXPECT_EQ(kOk, statuses[1].code());
+  EXPECT_EQ(first_id + 2, client.NextMessageId());
+  EXPECT_TRUE(msgs.empty());
+}
+
+namespace {
+
+class TimingOutSyncWebSocket : public MockSyncWebSocket {
+ public:
+  explicit TimingOutSyncWebSocket(int* receive_count,
+                                  base::TimeDelta delay = base::TimeDelta())
+      : receive_count_(receive_count), delay_(delay) {}
+  ~TimingOutSyncWebSocket() override = default;
+
+  bool IsConnected() override { return connected_; }
+
+  bool Connect(const GURL& url) override {
+    connected_ = true;
+    return true;
+  }
+
+  bool Send(const std::string& message) override { return true; }
+
+  SyncWebSocket::StatusCode ReceiveNextMessage(
+      std::string* message,
+      const Timeout& timeout) override {
+    ++*receive_count_;
+    base::PlatformThread::Sleep(delay_);
+    return SyncWebSocket::StatusCode::kTimeout;
+  }
+
+  bool HasNextMessage() override { return false; }
+
+ private:
+  raw_ptr<int> receive_count_;
+  const base::TimeDelta delay_;
+  bool connected_ = false;
+};
+
+std::unique_ptr<SyncWebSocket> CreateTimingOutSyncWebSocket(
+    int* receive_count) {
+  return std::make_unique<TimingOutSyncWebSocket>(receive_count);
+}
+
+std::unique_ptr<SyncWebSocket> CreateSlowTimingOutSyncWebSocket(
+    int* receive_count,
+    base::TimeDelta delay) {
+  return std::make_unique<TimingOutSyncWebSocket>(receive_count, delay);
+}
+
+}  // namespace
+
+TEST_F(DevToolsClientImplTest, SendCommandBatchStopsWaitingAfterTimeout) {
+  int receive_count = 0;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateTimingOutSyncWebSocket, &receive_count);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  base::DictionaryValue params;
+  std::vector<Status> statuses;
+  Status status = client.SendCommandBatch(
+      {{"first", &params}, {"second", &params}, {"third", &params}},
+      &statuses);
+  EXPECT_EQ(kTimeout, status.code());
+  ASSERT_EQ(3u, statuses.size());
+  for (const Status& command_status : statuses)
+    EXPECT_EQ(kTimeout, command_status.code());
+  // Only the first command waited for its response.
+  EXPECT_EQ(1, receive_count);
+}
+
+TEST_F(DevToolsClientImplTest, RecordsTimeBlockedOnTheBrowser) {
+  int receive_count = 0;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateSlowTimingOutSyncWebSocket, &receive_count,
+                          base::Milliseconds(20));
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  base::DictionaryValue params;
+  {
+    // Commands that are not waited for do not block.
+    ScopedCdpCallRecorder recorder;
+    ASSERT_EQ(kOk, client.SendAsyncCommand("first", params).code());
+    ASSERT_EQ(kOk,
+              client.SendCommandAndIgnoreResponse("second", params).code());
+    EXPECT_TRUE(recorder.blocked_time().is_zero());
+  }
+  ScopedCdpCallRecorder recorder;
+  std::vector<Status> statuses;
+  client.SendCommandBatch({{"third", &params}, {"fourth", &params}},
+                          &statuses);
+  ASSERT_EQ(1, receive_count);
+  EXPECT_LE(base::Milliseconds(20), recorder.blocked_time());
+}
+
+namespace {
+
+void StoreAsyncResult(bool* is_called,
+                      Status* status,
+                      base::Value* result,
+                      const Status& command_status,
+                      base::Value command_result) {
+  *is_called = true;
+  *status = command_status;
+  *result = std::move(command_result);
+}
+
+}  // namespace
+
+TEST_F(DevToolsClientImplTest, SendCommandAndGetResultAsync) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  int async_id = client.NextMessageId();
+  bool is_called = false;
+  Status async_status(kUnknownError);
+  base::Value async_result;
+  base::DictionaryValue params;
+  ASSERT_EQ(kOk, client
+                     .SendCommandAndGetResultAsync(
+                         "async", params,
+                         base::BindOnce(&StoreAsyncResult, &is_called,
+                                        &async_status, &async_result))
+                     .code());
+  EXPECT_FALSE(is_called);
+
+  // The response to the asynchronous command is routed while a synchronous
+  // command waits for its own response.
+  msgs.push_back((std::stringstream() << "{\"id\": " << async_id
+                                      << ", \"result\": {\"key\": 3}}")
+                     .str());
+  msgs.push_back((std::stringstream()
+                  << "{\"id\": " << async_id + 1 << ", \"result\": {}}")
+                     .str());
+  ASSERT_EQ(kOk, client.SendCommand("sync", params).code());
+  ASSERT_TRUE(is_called);
+  EXPECT_EQ(kOk, async_status.code());
+  ASSERT_TRUE(async_result.is_dict());
+  EXPECT_EQ(3, async_result.GetDict().FindInt("key").value_or(-1));
+}
+
+namespace {
+
+void StoreAsyncKey(std::vector<int>* keys,
+                   const Status& command_status,
+                   base::Value command_result) {
+  ASSERT_EQ(kOk, command_status.code());
+  ASSERT_TRUE(command_result.is_dict());
+  keys->push_back(command_result.GetDict().FindInt("key").value_or(-1));
+}
+
+}  // namespace
+
+TEST_F(DevToolsClientImplTest, ManyPendingCommandsRespondedOutOfOrder) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  // More commands than the pending command table has slots, so that some of
+  // the ids share a slot.
+  const int kCommandCount = 150;
+  int first_id = client.NextMessageId();
+  std::vector<int> keys;
+  base::DictionaryValue params;
+  for (int i = 0; i < kCommandCount; ++i) {
+    ASSERT_EQ(kOk,
+              client
+                  .SendCommandAndGetResultAsync(
+                      "async", params, base::BindOnce(&StoreAsyncKey, &keys))
+                  .code());
+  }
+  for (int i = kCommandCount - 1; i >= 0; --i) {
+    msgs.push_back((std::stringstream() << "{\"id\": " << first_id + i
+                                        << ", \"result\": {\"key\": " << i
+                                        << "}}")
+                       .str());
+  }
+  msgs.push_back((std::stringstream()
+                  << "{\"id\": " << first_id + kCommandCount
+                  << ", \"result\": {}}")
+                     .str());
+  ASSERT_EQ(kOk, client.SendCommand("sync", params).code());
+  ASSERT_EQ(static_cast<size_t>(kCommandCount), keys.size());
+  for (int i = 0; i < kCommandCount; ++i)
+    EXPECT_EQ(kCommandCount - 1 - i, keys[i]);
+  EXPECT_TRUE(msgs.empty());
+
+  // A response for an already completed command is unexpected.
+  msgs.push_back(
+      (std::stringstream() << "{\"id\": " << first_id << ", \"result\": {}}")
+          .str());
+  EXPECT_EQ(kUnknownError, client.HandleReceivedEvents().code());
+}
+
+namespace {
+
+struct PendingCommand : public base::RefCounted<PendingCommand> {
+ private:
+  friend class base::RefCounted<PendingCommand>;
+  ~PendingCommand() = default;
+};
+
+}  // namespace
+
+TEST(PendingCommandTable, FindsAndTakesCommands) {
+  internal::PendingCommandTable<PendingCommand> table;
+  auto first = base::MakeRefCounted<PendingCommand>();
+  auto colliding = base::MakeRefCounted<PendingCommand>();
+  table.Insert(1, first);
+  // 65 shares the slot of 1.
+  table.Insert(65, colliding);
+  ASSERT_EQ(first.get(), table.Find(1));
+  ASSERT_EQ(colliding.get(), table.Find(65));
+  ASSERT_FALSE(table.Find(2));
+  ASSERT_EQ(2u, table.GetUpTo(65).size());
+  ASSERT_EQ(1u, table.GetUpTo(64).size());
+  ASSERT_EQ(first, table.Take(1));
+  ASSERT_FALSE(table.Find(1));
+  ASSERT_EQ(colliding, table.Take(65));
+  ASSERT_FALSE(table.Take(65));
+}
+
+// Compares the heap bytes allocated to track the commands in flight, by the
+// map that used to track them and by the table. The commands themselves are
+// allocated by both and left out.
+TEST(PendingCommandTable, AllocatesLessThanMap) {
+  if (!GetMallocUsage())
+    GTEST_SKIP() << "The malloc usage is not available";
+  const int kCommandsInFlight = 64;
+  std::vector<scoped_refptr<PendingCommand>> commands;
+  for (int i = 0; i < kCommandsInFlight; ++i)
+    commands.push_back(base::MakeRefCounted<PendingCommand>());
+  std::map<int, scoped_refptr<PendingCommand>> map;
+  internal::PendingCommandTable<PendingCommand> table;
+
+  size_t malloc_usage = GetMallocUsage();
+  for (int i = 0; i < kCommandsInFlight; ++i)
+    map[i + 1] = commands[i];
+  size_t map_bytes = GetMallocUsage() - malloc_usage;
+
+  malloc_usage = GetMallocUsage();
+  for (int i = 0; i < kCommandsInFlight; ++i)
+    table.Insert(i + 1, commands[i]);
+  size_t table_bytes = GetMallocUsage() - malloc_usage;
+
+  testing::Test::RecordProperty("map_bytes", base::NumberToString(map_bytes));
+  testing::Test::RecordProperty("table_bytes",
+                                base::NumberToString(table_bytes));
+  EXPECT_LT(table_bytes, map_bytes);
+  for (int i = 0; i < kCommandsInFlight; ++i)
+    EXPECT_EQ(commands[i], table.Take(i + 1));
+}
+
+TEST_F(DevToolsClientImplTest, SendCommandAndGetResultAsyncError) {
+  std::list<std::string> msgs;
+  SyncWebSocketFactory factory =
+      base::BindRepeating(&CreateMockSyncWebSocket6, &msgs);
+  DevToolsClientImpl client("id", "", "http://url", factory);
+  ASSERT_EQ(kOk, client.ConnectIfNecessary().code());
+  int async_id = client.NextMessageId();
+  bool is_called = false;
+  Status async_status(kOk);
+  base::Value async_result;
+  base::DictionaryValue params;
+  ASSERT_EQ(kOk, client
+                     .SendCommandAndGetResultAsync(
+                         "async", params,
+                         base::BindOnce(&StoreAsyncResult, &is_called,
+                                        &async_status, &async_result))
+                     .code());
+  msgs.push_back((std::stringstream()
+                  << "{\"id\": " << async_id
+                  << ", \"error\": {\"code\": -32601, \"message\": \"x\"}}")
+                     .str());
+  ASSERT_EQ(kOk, client.HandleReceivedEvents().code());
+  ASSERT_TRUE(is_called);
+  EXPECT_EQ(kUnknownCommand, async_status.code());
+}
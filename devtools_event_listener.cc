@@ -16,6 +16,11 @@ Status DevToolsEventListener::OnConnected(DevToolsClient* client) {
   return Status(kOk);
 }
 
+base::flat_set<std::string> DevToolsEventListener::GetListenedEventMethods()
+    const {
+  return {};
+}
+
 Status DevToolsEventListener::OnEvent(DevToolsClient* client,
                                       const std::string& method,
                                       const base::DictionaryValue& params) {
@@ -7,6 +7,8 @@
 
 #include <string>
 
+#include "base/containers/flat_set.h"
+
 namespace base {
 class DictionaryValue;
 }
@@ -26,6 +28,12 @@ class DevToolsEventListener {
   // Called when a connection is made to the DevTools server.
   virtual Status OnConnected(DevToolsClient* client);
 
+  // Returns the event methods the listener is interested in. It is queried
+  // once, when the listener is added to a |DevToolsClient|, which then avoids
+  // parsing events that none of its listeners care about. An empty set, which
+  // is the default, means that the listener receives all events.
+  virtual base::flat_set<std::string> GetListenedEventMethods() const;
+
   // Called when an event is received. Should avoid blocking if possible.
   virtual Status OnEvent(DevToolsClient* client,
                          const std::string& method,
@@ -7,6 +7,7 @@
 #include <stddef.h>
 
 #include <cmath>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -176,6 +177,82 @@ Status SendKeysToElement(Session* session,
   return SendKeysOnWindow(web_view, key_list, true, &session->sticky_modifiers);
 }
 
+// The function queried by ExecuteQueryElements, which CallFunctionWithAtoms
+// passes the atoms it needs as members of |atoms|. Each query is either a
+// name of those atoms, 'tagName', 'rect', or a kind and a name separated by a
+// colon.
+const char kQueryElementsScript[] =
+    "function(atoms, elements, queries) {"
+    " const isXml = document.contentType.toLowerCase() === 'text/xml';"
+    " const query = function(element, q) {"
+    "   const colon = q.indexOf(':');"
+    "   if (colon != -1) {"
+    "     const kind = q.substring(0, colon);"
+    "     const name = q.substring(colon + 1);"
+    "     if (kind === 'attribute')"
+    "       return element.getAttribute(name);"
+    "     if (kind === 'booleanAttribute')"
+    "       return element.hasAttribute(name) ? 'true' : null;"
+    "     if (kind === 'legacyAttribute')"
+    "       return atoms.attribute(element, name);"
+    "     return element[name];"
+    "   }"
+    "   if (q === 'tagName')"
+    "     return element.tagName.toLowerCase();"
+    "   if (q === 'enabled' && isXml)"
+    "     return false;"
+    "   if (q === 'rect') {"
+    "     const location = atoms.location(element);"
+    "     const size = atoms.size(element);"
+    "     return {x: location.x, y: location.y, width: size.width,"
+    "             height: size.height};"
+    "   }"
+    "   return atoms[q](element);"
+    " };"
+    " return elements.map(function(element) {"
+    "   return queries.map(function(q) { return query(element, q); });"
+    " });"
+    "}";
+
+// Translates the property name |property| of the query elements command to
+// the query evaluated by kQueryElementsScript, and records the atoms the
+// query needs in |atoms|.
+Status GetElementQuery(Session* session,
+                       const std::string& property,
+                       std::map<std::string, const char* const*>* atoms,
+                       std::string* query) {
+  if (property == "text") {
+    (*atoms)["text"] = webdriver::atoms::GET_TEXT;
+  } else if (property == "displayed") {
+    (*atoms)["displayed"] = webdriver::atoms::IS_DISPLAYED;
+  } else if (property == "enabled") {
+    (*atoms)["enabled"] = webdriver::atoms::IS_ENABLED;
+  } else if (property == "selected") {
+    (*atoms)["selected"] = webdriver::atoms::IS_SELECTED;
+  } else if (property == "rect") {
+    (*atoms)["location"] = webdriver::atoms::GET_LOCATION;
+    (*atoms)["size"] = webdriver::atoms::GET_SIZE;
+  } else if (base::StartsWith(property, "attribute:",
+                              base::CompareCase::SENSITIVE)) {
+    std::string name = property.substr(property.find(':') + 1);
+    if (!session->w3c_compliant) {
+      (*atoms)["attribute"] = webdriver::atoms::GET_ATTRIBUTE;
+      *query = "legacyAttribute:" + name;
+    } else if (booleanAttributes.count(base::ToLowerASCII(name))) {
+      *query = "booleanAttribute:" + name;
+    } else {
+      *query = property;
+    }
+    return Status(kOk);
+  } else if (property != "tagName" &&
+             !base::StartsWith(property, "property:",
+                               base::CompareCase::SENSITIVE)) {
+    return Status(kInvalidArgument, "unknown element property " + property);
+  }
+  *query = property;
+  return Status(kOk);
+}
+
 }  // namespace
 
 Status ExecuteElementCommand(
@@ -519,10 +596,8 @@ Status ExecuteClearElement(Session* session,
   base::Value::List args;
   args.Append(CreateElement(element_id));
   std::unique_ptr<base::Value> result;
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::CLEAR),
-      args, &result);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::CLEAR, args, &result);
 }
 
 Status ExecuteSendKeysToElement(Session* session,
@@ -727,11 +802,8 @@ Status ExecuteSubmitElement(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::SUBMIT),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::SUBMIT, args, value);
 }
 
 Status ExecuteGetElementText(Session* session,
@@ -744,11 +816,8 @@ Status ExecuteGetElementText(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::GET_TEXT),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::GET_TEXT, args, value);
 }
 
 Status ExecuteGetElementValue(Session* session,
@@ -818,11 +887,8 @@ Status ExecuteIsElementSelected(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::IS_SELECTED),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::IS_SELECTED, args, value);
 }
 
 Status ExecuteIsElementEnabled(Session* session,
@@ -845,11 +911,8 @@ Status ExecuteIsElementEnabled(Session* session,
     *value = std::make_unique<base::Value>(false);
     return Status(kOk);
   } else {
-    return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::IS_ENABLED),
-      args,
-      value);
+    return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                       webdriver::atoms::IS_ENABLED, args, value);
   }
 }
 
@@ -918,11 +981,8 @@ Status ExecuteIsElementDisplayed(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::IS_DISPLAYED),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::IS_DISPLAYED, args, value);
 }
 
 Status ExecuteGetElementLocation(Session* session,
@@ -935,11 +995,8 @@ Status ExecuteGetElementLocation(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::GET_LOCATION),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::GET_LOCATION, args, value);
 }
 
 Status ExecuteGetElementRect(Session* session,
@@ -954,17 +1011,14 @@ Status ExecuteGetElementRect(Session* session,
   args.Append(CreateElement(element_id));
 
   std::unique_ptr<base::Value> location;
-  status = web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::GET_LOCATION), args,
-      &location);
+  status = CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                       webdriver::atoms::GET_LOCATION, args, &location);
   if (status.IsError())
     return status;
 
   std::unique_ptr<base::Value> size;
-  status = web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::GET_SIZE), args, &size);
+  status = CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                       webdriver::atoms::GET_SIZE, args, &size);
   if (status.IsError())
     return status;
 
@@ -1028,11 +1082,8 @@ Status ExecuteGetElementSize(Session* session,
     return status;
   base::Value::List args;
   args.Append(CreateElement(element_id));
-  return web_view->CallFunction(
-      session->GetCurrentFrameId(),
-      webdriver::atoms::asString(webdriver::atoms::GET_SIZE),
-      args,
-      value);
+  return CallAtomsJs(session->GetCurrentFrameId(), web_view,
+                     webdriver::atoms::GET_SIZE, args, value);
 }
 
 Status ExecuteGetElementAttribute(Session* session,
@@ -1182,3 +1233,62 @@ Status ExecuteElementScreenshot(Session* session,
   *value = std::make_unique<base::Value>(screenshot);
   return Status(kOk);
 }
+
+Status ExecuteQueryElements(Session* session,
+                            WebView* web_view,
+                            const base::DictionaryValue& params,
+                            std::unique_ptr<base::Value>* value,
+                            Timeout* timeout) {
+  const base::Value::List* element_ids = params.GetDict().FindList("elements");
+  if (!element_ids)
+    return Status(kInvalidArgument, "'elements' must be a list");
+  const base::Value::List* properties =
+      params.GetDict().FindList("properties");
+  if (!properties)
+    return Status(kInvalidArgument, "'properties' must be a list");
+
+  base::Value::List elements;
+  for (const base::Value& element_id : *element_ids) {
+    if (!element_id.is_string())
+      return Status(kInvalidArgument, "element ids must be strings");
+    Status status = CheckElement(element_id.GetString());
+    if (status.IsError())
+      return status;
+    elements.Append(CreateElement(element_id.GetString()));
+  }
+  std::map<std::string, const char* const*> atoms;
+  base::Value::List queries;
+  for (const base::Value& property : *properties) {
+    if (!property.is_string())
+      return Status(kInvalidArgument, "properties must be strings");
+    std::string query;
+    Status status =
+        GetElementQuery(session, property.GetString(), &atoms, &query);
+    if (status.IsError())
+      return status;
+    queries.Append(query);
+  }
+
+  base::Value::Dict table;
+  table.Set("properties", properties->Clone());
+  if (elements.empty()) {
+    table.Set("values", base::Value::List());
+    *value = std::make_unique<base::Value>(std::move(table));
+    return Status(kOk);
+  }
+
+  base::Value::List args;
+  args.Append(std::move(elements));
+  args.Append(std::move(queries));
+  std::unique_ptr<base::Value> result;
+  Status status =
+      CallFunctionWithAtoms(session->GetCurrentFrameId(), web_view,
+                            kQueryElementsScript, atoms, args, &result);
+  if (status.IsError())
+    return status;
+  if (!result || !result->is_list())
+    return Status(kUnknownError, "query returns unexpected result");
+  table.Set("values", std::move(*result));
+  *value = std::make_unique<base::Value>(std::move(table));
+  return Status(kOk);
+}
@@ -243,4 +243,15 @@ Status ExecuteFindChildElementsFromShadowRoot(
     const base::DictionaryValue& params,
     std::unique_ptr<base::Value>* value);
 
+// Queries the given properties of several elements of the current frame at
+// once. |params| holds the element ids in "elements" and the property names,
+// e.g. "text", "displayed", "rect" or "attribute:href", in "properties".
+// Returns {"properties": [...], "values": [[...], ...]} with one row of
+// property values per element.
+Status ExecuteQueryElements(Session* session,
+                            WebView* web_view,
+                            const base::DictionaryValue& params,
+                            std::unique_ptr<base::Value>* value,
+                            Timeout* timeout);
+
 #endif  // CHROME_TEST_CHROMEDRIVER_ELEMENT_COMMANDS_H_
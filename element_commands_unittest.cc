@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/status.h"
@@ -96,3 +97,248 @@ TEST(ElementCommandsTest, ExecuteGetElementRect_SizeError) {
                                      params, &result_value);
   ASSERT_EQ(kStaleElementReference, status.code()) << status.message();
 }
+
+namespace {
+
+class QueryElementsWebView : public StubWebView {
+ public:
+  QueryElementsWebView() : StubWebView("1") {}
+  ~QueryElementsWebView() override = default;
+
+  Status CallFunction(const std::string& frame,
+                      const std::string& function,
+                      const base::Value::List& args,
+                      std::unique_ptr<base::Value>* result) override {
+    ++calls_;
+    function_ = function;
+    args_ = args.Clone();
+    base::Value::List values;
+    for (size_t i = 0; i < args[0].GetList().size(); ++i) {
+      base::Value::List row;
+      row.Append("text");
+      row.Append(base::Value());
+      row.Append("http://test");
+      values.Append(std::move(row));
+    }
+    *result = std::make_unique<base::Value>(std::move(values));
+    return Status(kOk);
+  }
+
+  int calls_ = 0;
+  std::string function_;
+  base::Value::List args_;
+};
+
+}  // namespace
+
+TEST(ElementCommandsTest, ExecuteQueryElements) {
+  QueryElementsWebView web_view;
+  Session session("id");
+  session.w3c_compliant = true;
+  base::Value::Dict params;
+  base::Value::List elements;
+  elements.Append("3247f4d1-ce70-49e9-9a99-bdc7591e032f");
+  elements.Append("d9cf1666-0066-4c07-bb86-03edcbab6680");
+  params.Set("elements", std::move(elements));
+  base::Value::List properties;
+  properties.Append("text");
+  properties.Append("attribute:checked");
+  properties.Append("attribute:href");
+  params.Set("properties", properties.Clone());
+  std::unique_ptr<base::Value> result;
+  Status status = ExecuteQueryElements(
+      &session, &web_view,
+      base::Value::AsDictionaryValue(base::Value(std::move(params))), &result,
+      nullptr);
+  ASSERT_EQ(kOk, status.code()) << status.message();
+
+  // All properties of all elements are queried at once.
+  ASSERT_EQ(1, web_view.calls_);
+  ASSERT_EQ(2U, web_view.args_.size());
+  ASSERT_EQ(2U, web_view.args_[0].GetList().size());
+  base::Value::List expected_queries;
+  expected_queries.Append("text");
+  expected_queries.Append("booleanAttribute:checked");
+  expected_queries.Append("attribute:href");
+  ASSERT_EQ(expected_queries, web_view.args_[1].GetList());
+  EXPECT_NE(std::string::npos,
+            web_view.function_.find(
+                webdriver::atoms::asString(webdriver::atoms::GET_TEXT)));
+  EXPECT_EQ(std::string::npos,
+            web_view.function_.find(
+                webdriver::atoms::asString(webdriver::atoms::IS_DISPLAYED)));
+
+  ASSERT_TRUE(result && result->is_dict());
+  const base::Value::List* result_properties =
+      result->GetDict().FindList("properties");
+  ASSERT_TRUE(result_properties);
+  ASSERT_EQ(properties, *result_properties);
+  const base::Value::List* values = result->GetDict().FindList("values");
+  ASSERT_TRUE(values);
+  ASSERT_EQ(2U, values->size());
+}
+
+TEST(ElementCommandsTest, ExecuteQueryElements_UnknownProperty) {
+  QueryElementsWebView web_view;
+  Session session("id");
+  base::Value::Dict params;
+  params.Set("elements", base::Value::List());
+  base::Value::List properties;
+  properties.Append("color");
+  params.Set("properties", std::move(properties));
+  std::unique_ptr<base::Value> result;
+  ASSERT_EQ(kInvalidArgument,
+            ExecuteQueryElements(&session, &web_view,
+                                 base::Value::AsDictionaryValue(
+                                     base::Value(std::move(params))),
+                                 &result, nullptr)
+                .code());
+  ASSERT_EQ(0, web_view.calls_);
+}
+
+namespace {
+
+class RecordFunctionsWebView : public StubWebView {
+ public:
+  RecordFunctionsWebView() : StubWebView("1") {}
+  ~RecordFunctionsWebView() override = default;
+
+  Status CallFunction(const std::string& frame,
+                      const std::string& function,
+                      const base::Value::List& args,
+                      std::unique_ptr<base::Value>* result) override {
+    functions_.push_back(function);
+    if (lose_atoms_ && function.size() < 1000) {
+      base::Value::Dict missing;
+      missing.Set("chromedriver.atomMissing", true);
+      *result = std::make_unique<base::Value>(std::move(missing));
+    } else {
+      *result = std::make_unique<base::Value>("text");
+    }
+    return Status(kOk);
+  }
+
+  bool lose_atoms_ = false;
+  std::vector<std::string> functions_;
+};
+
+}  // namespace
+
+TEST(ElementCommandsTest, AtomsAreInstalledOncePerContext) {
+  SetThreadLocalSession(std::make_unique<Session>("id"));
+  Session* session = GetThreadLocalSession();
+  session->w3c_compliant = false;
+  RecordFunctionsWebView web_view;
+  const std::string atom =
+      webdriver::atoms::asString(webdriver::atoms::GET_TEXT);
+  base::DictionaryValue params;
+  std::unique_ptr<base::Value> value;
+
+  // The atom source is only sent the first time.
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(kOk, ExecuteGetElementText(session, &web_view, "1", params,
+                                         &value)
+                       .code());
+    ASSERT_EQ("text", value->GetString());
+  }
+  ASSERT_EQ(2U, web_view.functions_.size());
+  EXPECT_NE(std::string::npos, web_view.functions_[0].find(atom));
+  EXPECT_EQ(std::string::npos, web_view.functions_[1].find(atom));
+  // The registry is not at a well-known place, and only the install function
+  // can add atoms to it.
+  const std::pair<std::string, std::string> context("1", std::string());
+  ASSERT_EQ(1U, session->installed_atoms.count(context));
+  const std::string registry_key =
+      session->installed_atoms[context].registry_key;
+  ASSERT_FALSE(registry_key.empty());
+  EXPECT_NE(std::string::npos, web_view.functions_[1].find(registry_key));
+  EXPECT_NE(std::string::npos,
+            web_view.functions_[0].find(session->atom_registry_secret));
+  EXPECT_EQ(std::string::npos,
+            web_view.functions_[1].find(session->atom_registry_secret));
+
+  // A new execution context in another frame or web view keeps the atoms.
+  session->ForgetInstalledAtoms("1", "frame");
+  session->ForgetInstalledAtoms("2");
+  ASSERT_EQ(kOk,
+            ExecuteGetElementText(session, &web_view, "1", params, &value)
+                .code());
+  ASSERT_EQ(3U, web_view.functions_.size());
+  EXPECT_EQ(std::string::npos, web_view.functions_[2].find(atom));
+
+  // A new execution context in the frame needs the source again, and a new
+  // registry.
+  session->ForgetInstalledAtoms("1", std::string());
+  ASSERT_EQ(kOk,
+            ExecuteGetElementText(session, &web_view, "1", params, &value)
+                .code());
+  ASSERT_EQ(4U, web_view.functions_.size());
+  EXPECT_NE(std::string::npos, web_view.functions_[3].find(atom));
+  EXPECT_NE(registry_key, session->installed_atoms[context].registry_key);
+
+  // So does a context that changed before its events were handled.
+  web_view.lose_atoms_ = true;
+  ASSERT_EQ(kOk,
+            ExecuteGetElementText(session, &web_view, "1", params, &value)
+                .code());
+  ASSERT_EQ("text", value->GetString());
+  ASSERT_EQ(6U, web_view.functions_.size());
+  EXPECT_EQ(std::string::npos, web_view.functions_[4].find(atom));
+  EXPECT_NE(std::string::npos, web_view.functions_[5].find(atom));
+
+  SetThreadLocalSession(nullptr);
+}
+
+TEST(ElementCommandsTest, QueryElementsCallsInstalledAtoms) {
+  SetThreadLocalSession(std::make_unique<Session>("id"));
+  Session* session = GetThreadLocalSession();
+  session->w3c_compliant = true;
+  QueryElementsWebView web_view;
+  const std::string atom =
+      webdriver::atoms::asString(webdriver::atoms::GET_TEXT);
+  base::Value::Dict params;
+  base::Value::List elements;
+  elements.Append("3247f4d1-ce70-49e9-9a99-bdc7591e032f");
+  params.Set("elements", std::move(elements));
+  base::Value::List properties;
+  properties.Append("text");
+  params.Set("properties", std::move(properties));
+  const base::Value params_value(std::move(params));
+  const base::DictionaryValue& dict_params =
+      base::Value::AsDictionaryValue(params_value);
+  std::unique_ptr<base::Value> result;
+
+  // The atoms are sent along with the first query only.
+  ASSERT_EQ(kOk, ExecuteQueryElements(session, &web_view, dict_params,
+                                      &result, nullptr)
+                     .code());
+  EXPECT_NE(std::string::npos, web_view.function_.find(atom));
+  EXPECT_NE(std::string::npos,
+            web_view.function_.find(session->atom_registry_secret));
+  ASSERT_EQ(kOk, ExecuteQueryElements(session, &web_view, dict_params,
+                                      &result, nullptr)
+                     .code());
+  EXPECT_EQ(std::string::npos, web_view.function_.find(atom));
+  EXPECT_EQ(std::string::npos,
+            web_view.function_.find(session->atom_registry_secret));
+  const std::pair<std::string, std::string> context("1", std::string());
+  EXPECT_NE(std::string::npos,
+            web_view.function_.find(
+                session->installed_atoms[context].registry_key));
+  // The atoms come before the arguments of the query.
+  ASSERT_EQ(2U, web_view.args_.size());
+
+  // The atoms they share with the other commands are not sent again.
+  RecordFunctionsWebView record_web_view;
+  base::DictionaryValue text_params;
+  std::unique_ptr<base::Value> value;
+  ASSERT_EQ(kOk, ExecuteGetElementText(
+                     session, &record_web_view,
+                     "3247f4d1-ce70-49e9-9a99-bdc7591e032f", text_params,
+                     &value)
+                     .code());
+  ASSERT_EQ(1U, record_web_view.functions_.size());
+  EXPECT_EQ(std::string::npos, record_web_view.functions_[0].find(atom));
+
+  SetThreadLocalSession(nullptr);
+}
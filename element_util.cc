@@ -4,14 +4,22 @@
 
 #include "chrome/test/chromedriver/element_util.h"
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "base/containers/adapters.h"
+#include "base/containers/contains.h"
+#include "base/hash/hash.h"
 #include "base/logging.h"
+#include "base/no_destructor.h"
+#include "base/strings/str_cat.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
 #include "base/threading/platform_thread.h"
 #include "base/time/time.h"
 #include "base/values.h"
@@ -23,6 +31,7 @@
 #include "chrome/test/chromedriver/chrome/web_view.h"
 #include "chrome/test/chromedriver/net/timeout.h"
 #include "chrome/test/chromedriver/session.h"
+#include "chrome/test/chromedriver/util.h"
 #include "third_party/abseil-cpp/absl/types/optional.h"
 #include "third_party/webdriver/atoms.h"
 
@@ -52,6 +61,249 @@ const char kFindSubFrameScript[] =
     "frame_id);"
     "}";
 
+// Installs a promise that resolves to true as soon as the find atom, which is
+// inserted between the two parts, matches an element, or to false once
+// |timeout| milliseconds have passed. The remaining arguments are passed to
+// the atom. A MutationObserver re-runs the atom whenever the document, or the
+// shadow root searched from, changes. The waiter previously installed, if
+// any, is stopped first.
+const char kInstallElementWaiterScriptStart[] =
+    "function(timeout) {"
+    " const find = ";
+const char kInstallElementWaiterScriptEnd[] =
+    ";"
+    " const args = Array.prototype.slice.call(arguments, 1);"
+    " const key = Symbol.for('chromedriver.elementWaiter');"
+    " if (window[key])"
+    "   window[key].done(false);"
+    " const waiter = {};"
+    " waiter.promise = new Promise(function(resolve) {"
+    "   const matches = function() {"
+    "     try {"
+    "       const r = find.apply(null, args);"
+    "       return Array.isArray(r) ? r.length > 0 : r != null;"
+    "     } catch (e) {"
+    "       return true;"
+    "     }"
+    "   };"
+    "   const observer = new MutationObserver(function() {"
+    "     if (matches())"
+    "       done(true);"
+    "   });"
+    "   const timer = setTimeout(function() { done(false); }, timeout);"
+    "   const done = function(found) {"
+    "     observer.disconnect();"
+    "     clearTimeout(timer);"
+    "     resolve(found);"
+    "   };"
+    "   waiter.done = done;"
+    "   const options ="
+    "       {attributes: true, characterData: true, childList: true,"
+    "        subtree: true};"
+    "   observer.observe(document, options);"
+    "   if (args[1] instanceof ShadowRoot)"
+    "     observer.observe(args[1], options);"
+    "   if (matches())"
+    "     done(true);"
+    " });"
+    " window[key] = waiter;"
+    "}";
+// Evaluates to the promise installed by the script above.
+const char kElementWaiterExpression[] =
+    "window[Symbol.for('chromedriver.elementWaiter')].promise";
+// Stops the waiter installed by the script above, if any.
+const char kStopElementWaiterExpression[] =
+    "(function() {"
+    " const waiter = window[Symbol.for('chromedriver.elementWaiter')];"
+    " if (waiter)"
+    "   waiter.done(false);"
+    "})()";
+
+// Key of the object returned when an installed atom went missing.
+const char kAtomMissingKey[] = "chromedriver.atomMissing";
+
+// Returns the identifier of |atom_function| in the page-side atom registry.
+const std::string& GetAtomId(const char* const* atom_function) {
+  static base::NoDestructor<base::Lock> lock;
+  static base::NoDestructor<std::map<const char* const*, std::string>> ids;
+  base::AutoLock auto_lock(*lock);
+  auto it = ids->find(atom_function);
+  if (it == ids->end()) {
+    it = ids->emplace(atom_function,
+                      base::NumberToString(base::PersistentHash(
+                          webdriver::atoms::asString(atom_function))))
+             .first;
+  }
+  return it->second;
+}
+
+// Returns the statements setting |registry| to the page-side atom registry
+// named |registry_key|, which they create if missing. The registry is a
+// function stored in a non-writable property of the window. It keeps the
+// atoms in a closure and only accepts new ones along with
+// Session::atom_registry_secret, so page scripts can neither replace the
+// registry nor the atoms in it.
+std::string GetCreateAtomRegistryScript(const Session& session,
+                                        const std::string& registry_key) {
+  return base::StrCat(
+      {" const key = '", registry_key, "';"
+       " let registry = window[key];"
+       " if (typeof registry !== 'function') {"
+       "   const atoms = Object.create(null);"
+       "   const secret = '", session.atom_registry_secret, "';"
+       "   registry = function(id, token, atom) {"
+       "     if (atom && token === secret && !(id in atoms))"
+       "       atoms[id] = atom;"
+       "     return atoms[id];"
+       "   };"
+       "   Object.defineProperty(window, key, {value: registry});"
+       " }"});
+}
+
+// Returns a function that installs the atom |atom_id|, whose source is
+// |atom_source|, in the registry named |registry_key| and calls it.
+std::string GetInstallAtomFunction(const Session& session,
+                                   const std::string& registry_key,
+                                   const std::string& atom_id,
+                                   const std::string& atom_source) {
+  return base::StrCat(
+      {"function() {", GetCreateAtomRegistryScript(session, registry_key),
+       " const atom = ", atom_source, ";"
+       " registry('", atom_id, "', '", session.atom_registry_secret,
+       "', atom);"
+       " return atom.apply(null, arguments);"
+       "}"});
+}
+
+// Returns a function that calls the atom |atom_id| installed in the registry
+// named |registry_key|, or returns {kAtomMissingKey: true} if it is missing.
+std::string GetCallAtomFunction(const std::string& registry_key,
+                                const std::string& atom_id) {
+  return base::StrCat(
+      {"function() {"
+       " const registry = window['", registry_key, "'];"
+       " const atom = typeof registry === 'function' && registry('", atom_id,
+       "');"
+       " return atom ? atom.apply(null, arguments) : {'", kAtomMissingKey,
+       "': true};"
+       "}"});
+}
+
+// Returns whether |result| tells that an installed atom went missing, i.e.
+// that the execution context changed before its events were handled.
+bool IsAtomMissing(const std::unique_ptr<base::Value>& result) {
+  return result && result->is_dict() &&
+         result->GetDict().FindBool(kAtomMissingKey);
+}
+
+// Returns the atoms installed in |frame| of |web_view|, creating the secret
+// and the registry key on first use.
+InstalledAtoms& GetInstalledAtoms(Session* session,
+                                  WebView* web_view,
+                                  const std::string& frame) {
+  if (session->atom_registry_secret.empty())
+    session->atom_registry_secret = GenerateId();
+  InstalledAtoms& installed =
+      session->installed_atoms[std::make_pair(web_view->GetId(), frame)];
+  if (installed.registry_key.empty())
+    installed.registry_key = GenerateId();
+  return installed;
+}
+
+// Records that |atom_ids| were installed in |frame| of |web_view|, unless its
+// execution context changed since the registry named |registry_key| was used.
+void AddInstalledAtoms(Session* session,
+                       WebView* web_view,
+                       const std::string& frame,
+                       const std::string& registry_key,
+                       const std::vector<std::string>& atom_ids) {
+  auto it = session->installed_atoms.find(
+      std::make_pair(web_view->GetId(), frame));
+  if (it == session->installed_atoms.end() ||
+      it->second.registry_key != registry_key) {
+    return;
+  }
+  it->second.atom_ids.insert(atom_ids.begin(), atom_ids.end());
+}
+
+// Returns a function that calls |function| with an object holding |atoms|,
+// keyed by their name, followed by its own arguments. The atoms already in
+// |installed| are looked up in its registry, or the function returns
+// {kAtomMissingKey: true} if one is missing. The other atoms are sent and
+// added to the registry. Without |session|, all atoms are sent
+// and nothing is installed.
+std::string GetCallWithAtomsFunction(
+    const Session* session,
+    const InstalledAtoms* installed,
+    const std::string& function,
+    const std::map<std::string, const char* const*>& atoms) {
+  std::string script = "function() {";
+  if (session) {
+    bool installs_atoms = false;
+    for (const auto& [name, atom] : atoms) {
+      if (!base::Contains(installed->atom_ids, GetAtomId(atom)))
+        installs_atoms = true;
+    }
+    if (installs_atoms) {
+      script += GetCreateAtomRegistryScript(*session, installed->registry_key);
+    } else {
+      base::StrAppend(
+          &script,
+          {" const registry = window['", installed->registry_key, "'];"
+           " if (typeof registry !== 'function')"
+           "   return {'", kAtomMissingKey, "': true};"});
+    }
+  }
+  script += " const atoms = {};";
+  for (const auto& [name, atom] : atoms) {
+    if (!session) {
+      base::StrAppend(&script, {" atoms['", name, "'] = ",
+                                webdriver::atoms::asString(atom), ";"});
+      continue;
+    }
+    const std::string& atom_id = GetAtomId(atom);
+    if (base::Contains(installed->atom_ids, atom_id)) {
+      base::StrAppend(&script,
+                      {" atoms['", name, "'] = registry('", atom_id, "');"
+                       " if (!atoms['", name, "'])"
+                       "   return {'", kAtomMissingKey, "': true};"});
+    } else {
+      base::StrAppend(&script,
+                      {" atoms['", name,
+                       "'] = ", webdriver::atoms::asString(atom), ";"
+                       " registry('", atom_id, "', '",
+                       session->atom_registry_secret, "', atoms['", name,
+                       "']);"});
+    }
+  }
+  base::StrAppend(&script,
+                  {" return (", function, ").apply(null,"
+                   " [atoms].concat(Array.prototype.slice.call(arguments)));"
+                   "}"});
+  return script;
+}
+
+// Upper bound on how long DevTools events stay unhandled while a command is
+// waiting between its polling attempts.
+const int kEventPumpIntervalMs = 10;
+
+// Waits for |duration| while handling the DevTools events that arrive in the
+// meantime, so that they are delivered to the listeners (e.g. BiDi events to
+// the user) instead of piling up until the next DevTools command.
+void WaitAndHandleEvents(WebView* web_view, base::TimeDelta duration) {
+  const base::TimeTicks deadline = base::TimeTicks::Now() + duration;
+  while (true) {
+    // The errors are ignored like in the proactive event consumption. The
+    // next command sent to |web_view| will report them.
+    web_view->HandleReceivedEvents();
+    base::TimeDelta remaining = deadline - base::TimeTicks::Now();
+    if (remaining <= base::TimeDelta())
+      return;
+    base::PlatformThread::Sleep(
+        std::min(remaining, base::Milliseconds(kEventPumpIntervalMs)));
+  }
+}
+
 bool ParseFromValue(base::Value* value, WebPoint* point) {
   if (!value->is_dict())
     return false;
@@ -102,15 +354,6 @@ std::unique_ptr<base::DictionaryValue> CreateValueFrom(const WebRect& rect) {
   return dict;
 }
 
-Status CallAtomsJs(const std::string& frame,
-                   WebView* web_view,
-                   const char* const* atom_function,
-                   const base::Value::List& args,
-                   std::unique_ptr<base::Value>* result) {
-  return web_view->CallFunction(
-      frame, webdriver::atoms::asString(atom_function), args, result);
-}
-
 Status VerifyElementClickable(
     const std::string& frame,
     WebView* web_view,
@@ -165,9 +408,8 @@ Status ScrollElementRegionIntoViewHelper(
   args.Append(center);
   args.Append(base::Value::FromUniquePtrValue(CreateValueFrom(region)));
   std::unique_ptr<base::Value> result;
-  status = web_view->CallFunction(
-      frame, webdriver::atoms::asString(webdriver::atoms::GET_LOCATION_IN_VIEW),
-      args, &result);
+  status = CallAtomsJs(frame, web_view,
+                       webdriver::atoms::GET_LOCATION_IN_VIEW, args, &result);
   if (status.IsError())
     return status;
   if (!ParseFromValue(result.get(), &tmp_location)) {
@@ -183,10 +425,9 @@ Status ScrollElementRegionIntoViewHelper(
       // Clicking at the target location isn't reaching the target element.
       // One possible cause is a scroll event handler has shifted the element.
       // Try again to get the updated location of the target element.
-      status = web_view->CallFunction(
-          frame,
-          webdriver::atoms::asString(webdriver::atoms::GET_LOCATION_IN_VIEW),
-          args, &result);
+      status = CallAtomsJs(frame, web_view,
+                           webdriver::atoms::GET_LOCATION_IN_VIEW, args,
+                           &result);
       if (status.IsError())
         return status;
       if (!ParseFromValue(result.get(), &tmp_location)) {
@@ -225,9 +466,8 @@ Status GetElementEffectiveStyle(
   args.Append(CreateElement(element_id));
   args.Append(property);
   std::unique_ptr<base::Value> result;
-  status = web_view->CallFunction(
-      frame, webdriver::atoms::asString(webdriver::atoms::GET_EFFECTIVE_STYLE),
-      args, &result);
+  status = CallAtomsJs(frame, web_view,
+                       webdriver::atoms::GET_EFFECTIVE_STYLE, args, &result);
   if (status.IsError())
     return status;
   if (!result->is_string()) {
@@ -300,8 +540,118 @@ Status GetElementLocationInViewCenterHelper(const std::string& frame,
   return Status(kOk);
 }
 
+// Waits in the page, for at most |timeout|, until |find_script| called with
+// |arguments| may find an element. Returns an error if the waiter could not
+// be installed or was lost, e.g. because the frame navigated.
+Status WaitForElementMutation(Session* session,
+                              WebView* web_view,
+                              const std::string& find_script,
+                              const base::Value::List& arguments,
+                              base::TimeDelta timeout) {
+  base::Value::List waiter_arguments;
+  waiter_arguments.Append(static_cast<int>(timeout.InMilliseconds()));
+  for (const base::Value& argument : arguments)
+    waiter_arguments.Append(argument.Clone());
+  std::unique_ptr<base::Value> result;
+  Status status = web_view->CallFunction(
+      session->GetCurrentFrameId(),
+      base::StrCat({kInstallElementWaiterScriptStart, find_script,
+                    kInstallElementWaiterScriptEnd}),
+      waiter_arguments, &result);
+  if (status.IsError())
+    return status;
+  status = web_view->EvaluateScript(session->GetCurrentFrameId(),
+                                    kElementWaiterExpression, true, &result);
+  if (status.IsError()) {
+    // Do not leave the observer running in the page. This fails harmlessly
+    // if the waiter was lost along with its document.
+    std::unique_ptr<base::Value> ignored;
+    web_view->EvaluateScript(session->GetCurrentFrameId(),
+                             kStopElementWaiterExpression, false, &ignored);
+    return status;
+  }
+  if (!result || !result->is_bool())
+    return Status(kUnknownError, "element waiter returns unexpected result");
+  return Status(kOk);
+}
+
 }  // namespace
 
+Status CallAtomsJs(const std::string& frame,
+                   WebView* web_view,
+                   const char* const* atom_function,
+                   const base::Value::List& args,
+                   std::unique_ptr<base::Value>* result) {
+  Session* session = GetThreadLocalSession();
+  if (!session) {
+    return web_view->CallFunction(
+        frame, webdriver::atoms::asString(atom_function), args, result);
+  }
+
+  const std::string& atom_id = GetAtomId(atom_function);
+  // The installed atoms may be forgotten while the function is called, as
+  // the events received meanwhile are handled, so they are not kept by
+  // reference across the calls.
+  const InstalledAtoms& installed =
+      GetInstalledAtoms(session, web_view, frame);
+  if (base::Contains(installed.atom_ids, atom_id)) {
+    Status status = web_view->CallFunction(
+        frame, GetCallAtomFunction(installed.registry_key, atom_id), args,
+        result);
+    if (status.IsError() || !IsAtomMissing(*result))
+      return status;
+    // The execution context changed before its events were handled.
+    session->ForgetInstalledAtoms(web_view->GetId(), frame);
+  }
+  const std::string registry_key =
+      GetInstalledAtoms(session, web_view, frame).registry_key;
+  Status status = web_view->CallFunction(
+      frame,
+      GetInstallAtomFunction(*session, registry_key, atom_id,
+                             webdriver::atoms::asString(atom_function)),
+      args, result);
+  if (status.IsOk())
+    AddInstalledAtoms(session, web_view, frame, registry_key, {atom_id});
+  return status;
+}
+
+Status CallFunctionWithAtoms(
+    const std::string& frame,
+    WebView* web_view,
+    const std::string& function,
+    const std::map<std::string, const char* const*>& atoms,
+    const base::Value::List& args,
+    std::unique_ptr<base::Value>* result) {
+  Session* session = GetThreadLocalSession();
+  if (!session) {
+    return web_view->CallFunction(
+        frame, GetCallWithAtomsFunction(nullptr, nullptr, function, atoms),
+        args, result);
+  }
+
+  std::vector<std::string> atom_ids;
+  for (const auto& [name, atom] : atoms)
+    atom_ids.push_back(GetAtomId(atom));
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    const InstalledAtoms& installed =
+        GetInstalledAtoms(session, web_view, frame);
+    const std::string registry_key = installed.registry_key;
+    Status status = web_view->CallFunction(
+        frame, GetCallWithAtomsFunction(session, &installed, function, atoms),
+        args, result);
+    if (status.IsError())
+      return status;
+    if (!IsAtomMissing(*result)) {
+      AddInstalledAtoms(session, web_view, frame, registry_key, atom_ids);
+      return status;
+    }
+    // The execution context changed before its events were handled, so the
+    // second attempt sends all atoms again.
+    session->ForgetInstalledAtoms(web_view->GetId(), frame);
+  }
+  return Status(kUnknownError, "atoms are missing from a new context");
+}
+
 std::string GetElementKey() {
   Session* session = GetThreadLocalSession();
   if (session && session->w3c_compliant)
@@ -391,11 +741,8 @@ Status FindElementCommon(int interval_ms,
   if (!params.GetString("value", &target))
     return Status(kInvalidArgument, "'value' must be a string");
 
-  std::string script;
-  if (only_one)
-    script = webdriver::atoms::asString(webdriver::atoms::FIND_ELEMENT);
-  else
-    script = webdriver::atoms::asString(webdriver::atoms::FIND_ELEMENTS);
+  const char* const* atom = only_one ? webdriver::atoms::FIND_ELEMENT
+                                     : webdriver::atoms::FIND_ELEMENTS;
   std::unique_ptr<base::DictionaryValue> locator(new base::DictionaryValue());
   locator->SetString(strategy, target);
   base::Value::List arguments;
@@ -409,10 +756,11 @@ Status FindElementCommon(int interval_ms,
 
   base::TimeTicks start_time = base::TimeTicks::Now();
   int context_retry = 0;
+  bool use_waiter = session->observe_element_waits;
   while (true) {
     std::unique_ptr<base::Value> temp;
-    Status status = web_view->CallFunction(
-        session->GetCurrentFrameId(), script, arguments, &temp);
+    Status status = CallAtomsJs(session->GetCurrentFrameId(), web_view, atom,
+                                arguments, &temp);
 
     // A "Cannot find context" error can occur due to transition from in-process
     // iFrame to OOPIF. Retry a couple of times.
@@ -445,7 +793,17 @@ Status FindElementCommon(int interval_ms,
       return Status(kOk);
     }
 
-    base::PlatformThread::Sleep(base::Milliseconds(interval_ms));
+    if (use_waiter) {
+      Status waiter_status = WaitForElementMutation(
+          session, web_view, webdriver::atoms::asString(atom), arguments,
+          session->implicit_wait - (base::TimeTicks::Now() - start_time));
+      if (waiter_status.IsOk())
+        continue;
+      // The waiter is lost across navigations and context changes; poll once
+      // before installing a new one in the next document.
+      VLOG(1) << "element waiter failed: " << waiter_status.message();
+    }
+    WaitAndHandleEvents(web_view, base::Milliseconds(interval_ms));
   }
 }
 
@@ -5,6 +5,7 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_ELEMENT_UTIL_H_
 #define CHROME_TEST_CHROMEDRIVER_ELEMENT_UTIL_H_
 
+#include <map>
 #include <memory>
 #include <string>
 
@@ -23,6 +24,25 @@ std::unique_ptr<base::DictionaryValue> CreateValueFrom(const WebPoint& point);
 
 Status CheckElement(const std::string& element_id);
 
+// Calls |atom_function| in |frame|. On the session thread, the atom is
+// installed once per execution context and later called by reference, see
+// Session::installed_atoms.
+Status CallAtomsJs(const std::string& frame,
+                   WebView* web_view,
+                   const char* const* atom_function,
+                   const base::Value::List& args,
+                   std::unique_ptr<base::Value>* result);
+
+// Calls |function| in |frame| with an object holding |atoms|, keyed by their
+// name, followed by |args|. The atoms are installed like in CallAtomsJs.
+Status CallFunctionWithAtoms(
+    const std::string& frame,
+    WebView* web_view,
+    const std::string& function,
+    const std::map<std::string, const char* const*>& atoms,
+    const base::Value::List& args,
+    std::unique_ptr<base::Value>* result);
+
 // |root_element_id| could be null when no root element is given.
 Status FindElement(int interval_ms,
                    bool only_one,
@@ -77,20 +77,35 @@ Status FrameTracker::OnConnected(DevToolsClient* client) {
   frame_to_target_map_.clear();
   attached_frames_.clear();
   // Enable target events to allow tracking iframe targets creation.
-  base::DictionaryValue params;
-  base::Value::Dict& dict = params.GetDict();
+  base::DictionaryValue auto_attach_params;
+  base::Value::Dict& dict = auto_attach_params.GetDict();
   dict.Set("autoAttach", true);
   dict.Set("flatten", true);
   dict.Set("waitForDebuggerOnStart", false);
-  Status status = client->SendCommand("Target.setAutoAttach", params);
+  Status status =
+      client->SendCommand("Target.setAutoAttach", auto_attach_params);
   if (status.IsError())
     return status;
-  // Enable runtime events to allow tracking execution context creation.
-  params.DictClear();
-  status = client->SendCommand("Runtime.enable", params);
-  if (status.IsError())
-    return status;
-  return client->SendCommand("Page.enable", params);
+  base::DictionaryValue empty_params;
+  // The domains are enabled independently, send them without waiting for
+  // each response in turn. Runtime events allow tracking execution context
+  // creation.
+  return client->SendCommandBatch(
+      {{"Runtime.enable", &empty_params}, {"Page.enable", &empty_params}},
+      nullptr);
+}
+
+base::flat_set<std::string> FrameTracker::GetListenedEventMethods() const {
+  return {
+      "Page.frameAttached",
+      "Page.frameDetached",
+      "Page.frameNavigated",
+      "Runtime.executionContextCreated",
+      "Runtime.executionContextDestroyed",
+      "Runtime.executionContextsCleared",
+      "Target.attachedToTarget",
+      "Target.detachedFromTarget",
+  };
 }
 
 Status FrameTracker::OnEvent(DevToolsClient* client,
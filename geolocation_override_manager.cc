@@ -29,6 +29,11 @@ Status GeolocationOverrideManager::OnConnected(DevToolsClient* client) {
   return ApplyOverrideIfNeeded();
 }
 
+base::flat_set<std::string>
+GeolocationOverrideManager::GetListenedEventMethods() const {
+  return {"Page.frameNavigated"};
+}
+
 Status GeolocationOverrideManager::OnEvent(
     DevToolsClient* client,
     const std::string& method,
@@ -59,6 +59,10 @@ bool HeapSnapshotTaker::ListensToConnections() const {
   return false;
 }
 
+base::flat_set<std::string> HeapSnapshotTaker::GetListenedEventMethods() const {
+  return {"HeapProfiler.addHeapSnapshotChunk"};
+}
+
 Status HeapSnapshotTaker::OnEvent(DevToolsClient* client,
                                   const std::string& method,
                                   const base::DictionaryValue& params) {
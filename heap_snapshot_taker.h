@@ -33,6 +33,7 @@ class HeapSnapshotTaker : public DevToolsEventListener {
 
   // Overridden from DevToolsEventListener:
   bool ListensToConnections() const override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
                  const base::DictionaryValue& params) override;
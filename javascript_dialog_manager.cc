@@ -76,6 +76,14 @@ Status JavaScriptDialogManager::OnConnected(DevToolsClient* client) {
   return client_->SendCommand("Page.enable", params);
 }
 
+base::flat_set<std::string>
+JavaScriptDialogManager::GetListenedEventMethods() const {
+  return {
+      "Page.javascriptDialogClosed",
+      "Page.javascriptDialogOpening",
+  };
+}
+
 Status JavaScriptDialogManager::OnEvent(DevToolsClient* client,
                                         const std::string& method,
                                         const base::DictionaryValue& params) {
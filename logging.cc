@@ -7,15 +7,20 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <utility>
 
 #include "base/command_line.h"
 #include "base/containers/contains.h"
+#include "base/files/file_util.h"
 #include "base/json/json_reader.h"
 #include "base/logging.h"
+#include "base/numerics/safe_conversions.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/stringprintf.h"
 #include "base/time/time.h"
 #include "build/build_config.h"
@@ -49,6 +54,8 @@ Log::Level g_log_level = Log::kWarning;
 
 int64_t g_start_time = 0;
 
+base::TimeDelta g_slow_command_threshold;
+
 bool readable_timestamp;
 
 // Array indices are the Log::Level enum values.
@@ -190,53 +197,147 @@ bool WebDriverLog::NameToLevel(const std::string& name, Log::Level* out_level) {
   return false;
 }
 
+namespace {
+
+using internal::PackedEntryHeader;
+
+// Chunks stop growing at this size, so that they are moved to disk or dropped
+// in pieces.
+const size_t kMaxChunkBytes = 1 << 20;
+
+const int kSourceIdBits = 24;
+const uint32_t kMaxSourceId = (1u << kSourceIdBits) - 1;
+
+uint32_t GetSourceId(const PackedEntryHeader& header) {
+  return header.source_and_level & kMaxSourceId;
+}
+
+Log::Level GetLevel(const PackedEntryHeader& header) {
+  return static_cast<Log::Level>(header.source_and_level >> kSourceIdBits);
+}
+
+// Heap bytes taken by |records|, none while they fit in the string itself.
+size_t GetAllocatedBytes(const std::string& records) {
+  size_t capacity = records.capacity();
+  return capacity > std::string().capacity() ? capacity : 0;
+}
+
+bool ReadPackedEntry(base::StringPiece records,
+                     size_t* offset,
+                     PackedEntryHeader* header,
+                     base::StringPiece* message) {
+  if (records.size() - *offset < sizeof(PackedEntryHeader))
+    return false;
+  memcpy(header, records.data() + *offset, sizeof(PackedEntryHeader));
+  *offset += sizeof(PackedEntryHeader);
+  if (records.size() - *offset < header->message_size)
+    return false;
+  *message = records.substr(*offset, header->message_size);
+  *offset += header->message_size;
+  return true;
+}
+
+}  // namespace
+
+WebDriverLog::Chunk::Chunk() = default;
+
+WebDriverLog::Chunk::Chunk(Chunk&& other) = default;
+
+WebDriverLog::Chunk& WebDriverLog::Chunk::operator=(Chunk&& other) = default;
+
+WebDriverLog::Chunk::~Chunk() = default;
+
 WebDriverLog::WebDriverLog(const std::string& type, Log::Level min_level)
-    : type_(type), min_level_(min_level), emptied_(true) {}
+    : type_(type), min_level_(min_level), emptied_(true), sources_(1) {}
 
 WebDriverLog::~WebDriverLog() {
   size_t sum = 0;
-  for (const std::unique_ptr<base::ListValue>& batch : batches_of_entries_)
-    sum += batch->GetList().size();
-  VLOG(1) << "Log type '" << type_ << "' lost " << sum
+  for (const Chunk& chunk : chunks_) {
+    sum += chunk.entries;
+    if (!chunk.spill_path.empty())
+      base::DeleteFile(chunk.spill_path);
+  }
+  VLOG(1) << "Log type '" << type_ << "' lost " << sum + dropped_entries_
           << " entries on destruction";
 }
 
 std::unique_ptr<base::ListValue> WebDriverLog::GetAndClearEntries() {
-  std::unique_ptr<base::ListValue> ret;
-  if (batches_of_entries_.empty()) {
-    ret = std::make_unique<base::ListValue>();
-    emptied_ = true;
-  } else {
-    ret = std::move(batches_of_entries_.front());
-    batches_of_entries_.pop_front();
-    emptied_ = false;
+  auto ret = std::make_unique<base::ListValue>();
+  emptied_ = chunks_.empty();
+  // The entries are serialized straight from their packed records, one chunk
+  // at a time.
+  while (!chunks_.empty() &&
+         ret->GetList().size() < internal::kMaxReturnedEntries) {
+    Chunk& chunk = chunks_.front();
+    if (!chunk.spill_path.empty()) {
+      if (!base::ReadFileToString(chunk.spill_path, &chunk.records))
+        LOG(WARNING) << "Cannot read log entries from " << chunk.spill_path;
+      base::DeleteFile(chunk.spill_path);
+      chunk.spill_path.clear();
+      resident_bytes_ += GetAllocatedBytes(chunk.records);
+    }
+
+    size_t offset = 0;
+    PackedEntryHeader header;
+    base::StringPiece message;
+    while (ret->GetList().size() < internal::kMaxReturnedEntries &&
+           ReadPackedEntry(chunk.records, &offset, &header, &message)) {
+      base::Value::Dict log_entry_dict;
+      log_entry_dict.Set("timestamp", static_cast<double>(header.timestamp));
+      log_entry_dict.Set("level", LevelToName(GetLevel(header)));
+      if (GetSourceId(header))
+        log_entry_dict.Set("source", sources_[GetSourceId(header)]);
+      log_entry_dict.Set("message", message);
+      ret->Append(base::Value(std::move(log_entry_dict)));
+      --chunk.entries;
+    }
+
+    if (offset < chunk.records.size() && chunk.entries) {
+      // The rest of the chunk is returned by the next call.
+      resident_bytes_ -= GetAllocatedBytes(chunk.records);
+      chunk.records.erase(0, offset);
+      chunk.records.shrink_to_fit();
+      resident_bytes_ += GetAllocatedBytes(chunk.records);
+      break;
+    }
+    resident_bytes_ -= GetAllocatedBytes(chunk.records);
+    chunks_.pop_front();
   }
   return ret;
 }
 
-bool GetFirstErrorMessageFromList(const base::ListValue* list,
-                                  std::string* message) {
-  for (const auto& entry : list->GetList()) {
-    if (entry.is_dict()) {
-      const base::Value::Dict& log_entry = entry.GetDict();
-      const std::string* level = log_entry.FindString("level");
-      if (!level || *level != kLevelToName[Log::kError])
-        continue;
-
-      if (const std::string* maybe_message = log_entry.FindString("message")) {
-        *message = *maybe_message;
-        return true;
-      }
-    }
+template <typename Callback>
+void WebDriverLog::ForEachEntry(const Chunk& chunk, Callback callback) const {
+  std::string spilled_records;
+  if (!chunk.spill_path.empty() &&
+      !base::ReadFileToString(chunk.spill_path, &spilled_records)) {
+    LOG(WARNING) << "Cannot read log entries from " << chunk.spill_path;
+    return;
+  }
+  base::StringPiece records =
+      chunk.spill_path.empty() ? chunk.records : spilled_records;
+  size_t offset = 0;
+  PackedEntryHeader header;
+  base::StringPiece message;
+  while (ReadPackedEntry(records, &offset, &header, &message)) {
+    if (!callback(header, message))
+      break;
   }
-  return false;
 }
 
 std::string WebDriverLog::GetFirstErrorMessage() const {
   std::string message;
-  for (const std::unique_ptr<base::ListValue>& list : batches_of_entries_)
-    if (GetFirstErrorMessageFromList(list.get(), &message))
+  for (const Chunk& chunk : chunks_) {
+    ForEachEntry(chunk, [&message](const PackedEntryHeader& header,
+                                   base::StringPiece entry_message) {
+      if (GetLevel(header) != Log::kError)
+        return true;
+      message = std::string(entry_message);
+      return false;
+    });
+    if (!message.empty())
       break;
+  }
   return message;
 }
 
@@ -247,24 +348,96 @@ void WebDriverLog::AddEntryTimestamped(const base::Time& timestamp,
   if (level < min_level_)
     return;
 
-  base::Value::Dict log_entry_dict;
-  log_entry_dict.Set("timestamp", std::trunc(timestamp.ToJsTime()));
-  log_entry_dict.Set("level", LevelToName(level));
-  if (!source.empty())
-    log_entry_dict.Set("source", source);
-  log_entry_dict.Set("message", message);
-  if (batches_of_entries_.empty() ||
-      batches_of_entries_.back()->GetList().size() >=
-          internal::kMaxReturnedEntries) {
-    batches_of_entries_.push_back(std::make_unique<base::ListValue>());
+  uint32_t source_id = 0;
+  if (!source.empty()) {
+    auto it = source_ids_.find(source);
+    if (it != source_ids_.end()) {
+      source_id = it->second;
+    } else if (sources_.size() <= kMaxSourceId) {
+      source_id = static_cast<uint32_t>(sources_.size());
+      source_ids_.emplace(source, source_id);
+      sources_.push_back(source);
+    }
   }
-  batches_of_entries_.back()->Append(base::Value(std::move(log_entry_dict)));
+
+  PackedEntryHeader header;
+  header.timestamp = static_cast<int64_t>(timestamp.ToJsTime());
+  header.message_size = base::checked_cast<uint32_t>(message.size());
+  header.source_and_level =
+      source_id | (static_cast<uint32_t>(level) << kSourceIdBits);
+
+  size_t max_chunk_bytes = kMaxChunkBytes;
+  if (max_bytes_)
+    max_chunk_bytes = std::min(max_chunk_bytes, max_bytes_ / 4 + 1);
+  if (chunks_.empty() || !chunks_.back().spill_path.empty() ||
+      chunks_.back().records.size() >= max_chunk_bytes) {
+    if (!chunks_.empty() && chunks_.back().spill_path.empty()) {
+      // The full chunk gives back what its string over-allocated.
+      Chunk& full_chunk = chunks_.back();
+      resident_bytes_ -= GetAllocatedBytes(full_chunk.records);
+      full_chunk.records.shrink_to_fit();
+      resident_bytes_ += GetAllocatedBytes(full_chunk.records);
+    }
+    chunks_.emplace_back();
+  }
+  Chunk& chunk = chunks_.back();
+  resident_bytes_ -= GetAllocatedBytes(chunk.records);
+  chunk.records.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  chunk.records.append(message);
+  resident_bytes_ += GetAllocatedBytes(chunk.records);
+  ++chunk.entries;
+  EnforceStorageLimit();
 }
 
 bool WebDriverLog::Emptied() const {
   return emptied_;
 }
 
+void WebDriverLog::SetStorageLimit(size_t max_bytes,
+                                   const base::FilePath& spill_dir) {
+  max_bytes_ = max_bytes;
+  spill_dir_ = spill_dir;
+  EnforceStorageLimit();
+}
+
+size_t WebDriverLog::resident_bytes() const {
+  return resident_bytes_;
+}
+
+void WebDriverLog::EnforceStorageLimit() {
+  if (!max_bytes_ || resident_bytes_ <= max_bytes_)
+    return;
+
+  if (spill_dir_.empty()) {
+    if (!dropped_entries_) {
+      LOG(WARNING) << "Log type '" << type_ << "' exceeds " << max_bytes_
+                   << " bytes, dropping the oldest entries";
+    }
+    while (resident_bytes_ > max_bytes_ && chunks_.size() > 1) {
+      resident_bytes_ -= GetAllocatedBytes(chunks_.front().records);
+      dropped_entries_ += chunks_.front().entries;
+      chunks_.pop_front();
+    }
+    return;
+  }
+
+  for (Chunk& chunk : chunks_) {
+    if (resident_bytes_ <= max_bytes_)
+      break;
+    if (!chunk.spill_path.empty())
+      continue;
+    base::FilePath spill_path = spill_dir_.AppendASCII(
+        base::StringPrintf("%s-%d.log", type_.c_str(), spilled_chunks_++));
+    if (!base::WriteFile(spill_path, chunk.records)) {
+      LOG(WARNING) << "Cannot move log entries to " << spill_path;
+      return;
+    }
+    resident_bytes_ -= GetAllocatedBytes(chunk.records);
+    chunk.records = std::string();
+    chunk.spill_path = spill_path;
+  }
+}
+
 const std::string& WebDriverLog::type() const {
   return type_;
 }
@@ -277,6 +450,14 @@ Log::Level WebDriverLog::min_level() const {
   return min_level_;
 }
 
+Log::Level GetLogLevel() {
+  return g_log_level;
+}
+
+base::TimeDelta GetSlowCommandThreshold() {
+  return g_slow_command_threshold;
+}
+
 bool InitLogging(uint16_t port) {
   g_start_time = base::TimeTicks::Now().ToInternalValue();
   base::CommandLine* cmd_line = base::CommandLine::ForCurrentProcess();
@@ -332,6 +513,18 @@ bool InitLogging(uint16_t port) {
     return false;
   }
 
+  if (cmd_line->HasSwitch("slow-command-threshold")) {
+    int threshold_ms;
+    if (!base::StringToInt(
+            cmd_line->GetSwitchValueASCII("slow-command-threshold"),
+            &threshold_ms) ||
+        threshold_ms <= 0) {
+      printf("Invalid --slow-command-threshold value.\n");
+      return false;
+    }
+    g_slow_command_threshold = base::Milliseconds(threshold_ms);
+  }
+
   // Turn on VLOG for chromedriver. This is parsed during logging::InitLogging.
   if (!cmd_line->HasSwitch("vmodule"))
     cmd_line->AppendSwitchASCII("vmodule", "*/chrome/test/chromedriver/*=3");
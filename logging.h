@@ -5,11 +5,18 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_LOGGING_H_
 #define CHROME_TEST_CHROMEDRIVER_LOGGING_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "base/containers/circular_deque.h"
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "base/time/time.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/log.h"
 
@@ -22,6 +29,19 @@ class Status;
 
 namespace internal {
 static const size_t kMaxReturnedEntries = 100000;
+
+// Header of an entry packed in the records of a WebDriverLog, followed by the
+// |message_size| bytes of the message.
+struct PackedEntryHeader {
+  // Milliseconds since the Unix epoch.
+  int64_t timestamp;
+  uint32_t message_size;
+  // The index of the source in the low 24 bits, the Log::Level in the high 8
+  // bits.
+  uint32_t source_and_level;
+};
+static_assert(sizeof(PackedEntryHeader) == 16,
+              "PackedEntryHeader must not have padding");
 }  // namespace internal
 
 // Accumulates WebDriver Logging API entries of a given type and minimum level.
@@ -44,10 +64,10 @@ class WebDriverLog : public Log {
 
   ~WebDriverLog() override;
 
-  // Returns entries accumulated so far, as a ListValue ready for serialization
-  // into the wire protocol response to the "/log" command.
-  // The caller assumes ownership of the ListValue, and the WebDriverLog
-  // creates and owns a new empty ListValue for further accumulation.
+  // Returns the oldest |kMaxReturnedEntries| entries accumulated so far, built
+  // from their packed form, as a ListValue ready for serialization into the
+  // wire protocol response to the "/log" command. The returned entries are
+  // removed from the log.
   std::unique_ptr<base::ListValue> GetAndClearEntries();
 
   // Finds the first error message in the log and returns it. If none exist,
@@ -60,29 +80,75 @@ class WebDriverLog : public Log {
                            const std::string& source,
                            const std::string& message) override;
 
-  // Whether or not batches_of_entries_ is empty when it is being emptied.
+  // Whether or not the log had no entries when it was last emptied.
   bool Emptied() const override;
 
+  // Caps the memory taken by the entries to about |max_bytes|, 0 for no cap.
+  // The oldest entries over the cap are moved to files in |spill_dir|, or
+  // dropped if |spill_dir| is empty.
+  void SetStorageLimit(size_t max_bytes, const base::FilePath& spill_dir);
+
+  // Bytes allocated for the entries kept in memory.
+  size_t resident_bytes() const;
+
   const std::string& type() const;
   void set_min_level(Level min_level);
   Level min_level() const;
 
  private:
+  // Entries packed back to back as records of a fixed size header followed by
+  // the message bytes.
+  struct Chunk {
+    Chunk();
+    Chunk(Chunk&& other);
+    Chunk& operator=(Chunk&& other);
+    ~Chunk();
+
+    std::string records;
+    size_t entries = 0;
+    // Set once the records have been moved to this file.
+    base::FilePath spill_path;
+  };
+
+  // Calls |callback| with the header and the message of the entries of
+  // |chunk| until it returns false.
+  template <typename Callback>
+  void ForEachEntry(const Chunk& chunk, Callback callback) const;
+  // Moves or drops the oldest chunks until the cap is respected.
+  void EnforceStorageLimit();
+
   const std::string type_;  // WebDriver log type.
   Level min_level_;  // Minimum level of entries to store.
   // Log is empty when it is emptied, or when it is initialized (because we
   // want GetLog to collect trace events initially).
   bool emptied_;
 
-  // A queue of batches of entries. Each batch can have no more than
-  // |kMaxReturnedEntries| values in it. This is to avoid HTTP response buffer
-  // overflow (crbug.com/681892).
-  base::circular_deque<std::unique_ptr<base::ListValue>> batches_of_entries_;
+  // Entries in the order they were added. GetAndClearEntries returns no more
+  // than |kMaxReturnedEntries| of them at a time. This is to avoid HTTP
+  // response buffer overflow (crbug.com/681892).
+  base::circular_deque<Chunk> chunks_;
+  size_t resident_bytes_ = 0;
+  size_t max_bytes_ = 0;
+  base::FilePath spill_dir_;
+  int spilled_chunks_ = 0;
+  size_t dropped_entries_ = 0;
+
+  // Sources of the entries, referred to by their index in the records. Entries
+  // of the sources past the 24-bit index limit are stored without a source.
+  std::vector<std::string> sources_;
+  std::map<std::string, uint32_t, std::less<>> source_ids_;
 };
 
 // Initializes logging system for ChromeDriver. Returns true on success.
 bool InitLogging(uint16_t port);
 
+// Returns the minimum level of the ChromeDriver log set by InitLogging.
+Log::Level GetLogLevel();
+
+// Returns the duration above which the breakdown of a command is logged, set
+// by --slow-command-threshold. Zero if slow commands are not logged.
+base::TimeDelta GetSlowCommandThreshold();
+
 // Creates |Log|s, |DevToolsEventListener|s, and |CommandListener|s based on
 // logging preferences.
 Status CreateLogs(
@@ -7,9 +7,15 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
 #include "base/format_macros.h"
+#include "base/process/process_metrics.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/stringprintf.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/capabilities.h"
@@ -185,3 +191,72 @@ TEST(Logging, OverflowLogs) {
   entries = log.GetAndClearEntries();
   ASSERT_EQ(1u, entries->GetList().size());
 }
+
+// Also a benchmark: run with --gtest_filter=Logging.PackedEntriesMemory
+// --gtest_output=xml to get the heap bytes taken by the entries, as
+// malloc_bytes, next to their resident_bytes.
+TEST(Logging, PackedEntriesMemory) {
+  const std::string message(100, 'x');
+  const size_t kEntries = 100000;
+  std::unique_ptr<base::ProcessMetrics> metrics =
+      base::ProcessMetrics::CreateCurrentProcessMetrics();
+  size_t malloc_usage_before = metrics->GetMallocUsage();
+  WebDriverLog log(WebDriverLog::kPerformanceType, Log::kAll);
+  for (size_t i = 0; i < kEntries; i++)
+    log.AddEntry(Log::kInfo, "network", message);
+  size_t malloc_usage_after = metrics->GetMallocUsage();
+
+  // A record is a header followed by the message, and the strings holding the
+  // records over-allocate at most the last one of the 1 MiB chunks.
+  size_t packed_bytes =
+      kEntries * (sizeof(internal::PackedEntryHeader) + message.size());
+  ASSERT_LE(packed_bytes, log.resident_bytes());
+  ASSERT_GE(packed_bytes + (2 << 20), log.resident_bytes());
+  testing::Test::RecordProperty("resident_bytes",
+                                base::NumberToString(log.resident_bytes()));
+  // GetMallocUsage() is 0 where it is not supported.
+  if (malloc_usage_before) {
+    size_t malloc_bytes = malloc_usage_after - malloc_usage_before;
+    testing::Test::RecordProperty("malloc_bytes",
+                                  base::NumberToString(malloc_bytes));
+    ASSERT_GE(packed_bytes + (4 << 20), malloc_bytes);
+  }
+
+  std::unique_ptr<base::ListValue> entries = log.GetAndClearEntries();
+  ASSERT_EQ(kEntries, entries->GetList().size());
+  const base::Value::Dict& entry = entries->GetList()[kEntries - 1].GetDict();
+  ASSERT_EQ("network", *entry.FindString("source"));
+  ASSERT_EQ(message, *entry.FindString("message"));
+  ASSERT_EQ(0u, log.resident_bytes());
+}
+
+TEST(Logging, SpillLogsToDisk) {
+  base::ScopedTempDir spill_dir;
+  ASSERT_TRUE(spill_dir.CreateUniqueTempDir());
+  WebDriverLog log(WebDriverLog::kPerformanceType, Log::kAll);
+  log.SetStorageLimit(1000, spill_dir.GetPath());
+  for (size_t i = 0; i < 1000; i++)
+    log.AddEntry(Log::kInfo, base::StringPrintf("%" PRIuS, i));
+  ASSERT_GE(1000u, log.resident_bytes());
+  ASSERT_FALSE(base::IsDirectoryEmpty(spill_dir.GetPath()));
+
+  std::unique_ptr<base::ListValue> entries = log.GetAndClearEntries();
+  ASSERT_EQ(1000u, entries->GetList().size());
+  for (size_t i = 0; i < 1000; i++)
+    ValidateLogEntry(entries.get(), i, "INFO", base::NumberToString(i));
+  ASSERT_TRUE(base::IsDirectoryEmpty(spill_dir.GetPath()));
+}
+
+TEST(Logging, DropLogsOverLimit) {
+  WebDriverLog log(WebDriverLog::kPerformanceType, Log::kAll);
+  log.SetStorageLimit(1000, base::FilePath());
+  for (size_t i = 0; i < 1000; i++)
+    log.AddEntry(Log::kInfo, base::StringPrintf("%" PRIuS, i));
+  ASSERT_GE(1000u, log.resident_bytes());
+
+  std::unique_ptr<base::ListValue> entries = log.GetAndClearEntries();
+  size_t size = entries->GetList().size();
+  ASSERT_LT(0u, size);
+  ASSERT_GT(1000u, size);
+  ValidateLogEntry(entries.get(), size - 1, "INFO", "999");
+}
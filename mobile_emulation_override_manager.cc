@@ -25,6 +25,11 @@ Status MobileEmulationOverrideManager::OnConnected(DevToolsClient* client) {
   return ApplyOverrideIfNeeded();
 }
 
+base::flat_set<std::string>
+MobileEmulationOverrideManager::GetListenedEventMethods() const {
+  return {"Page.frameNavigated"};
+}
+
 Status MobileEmulationOverrideManager::OnEvent(
     DevToolsClient* client,
     const std::string& method,
@@ -35,6 +35,7 @@ class MobileEmulationOverrideManager : public DevToolsEventListener {
 
   // Overridden from DevToolsEventListener:
   Status OnConnected(DevToolsClient* client) override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
                  const base::DictionaryValue& params) override;
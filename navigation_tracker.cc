@@ -6,7 +6,10 @@
 
 #include <unordered_map>
 
+#include "base/auto_reset.h"
+#include "base/lazy_instance.h"
 #include "base/strings/string_util.h"
+#include "base/threading/thread_local.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/browser_info.h"
 #include "chrome/test/chromedriver/chrome/devtools_client.h"
@@ -37,6 +40,9 @@ std::unordered_map<std::string, int> error_codes({
 
 const char kNetErrorStart[] = "net::ERR_";
 
+base::LazyInstance<base::ThreadLocalPointer<ScopedNavigationCommand>>::
+    DestructorAtExit lazy_tls_navigation_command = LAZY_INSTANCE_INITIALIZER;
+
 bool isNetworkError(const std::string& errorText) {
   if (!base::StartsWith(errorText, kNetErrorStart,
                         base::CompareCase::SENSITIVE))
@@ -54,6 +60,23 @@ bool isNetworkError(const std::string& errorText) {
 
 }  // namespace
 
+ScopedNavigationCommand::ScopedNavigationCommand(bool can_navigate)
+    : outer_(lazy_tls_navigation_command.Pointer()->Get()),
+      can_navigate_(can_navigate) {
+  lazy_tls_navigation_command.Pointer()->Set(this);
+}
+
+ScopedNavigationCommand::~ScopedNavigationCommand() {
+  lazy_tls_navigation_command.Pointer()->Set(outer_);
+  if (outer_)
+    outer_->skipped_round_trips_ += skipped_round_trips_;
+}
+
+// static
+ScopedNavigationCommand* ScopedNavigationCommand::Current() {
+  return lazy_tls_navigation_command.Pointer()->Get();
+}
+
 NavigationTracker::NavigationTracker(
     DevToolsClient* client,
     WebView* web_view,
@@ -96,6 +119,7 @@ void NavigationTracker::SetFrame(const std::string& new_frame_id) {
     current_frame_id_ = top_frame_id_;
   else
     current_frame_id_ = new_frame_id;
+  known_idle_ = false;
   auto it = frame_to_state_map_.find(current_frame_id_);
   if (it == frame_to_state_map_.end())
     setCurrentFrameInvalid();
@@ -113,6 +137,24 @@ Status NavigationTracker::IsPendingNavigation(const Timeout* timeout,
     *is_pending = false;
     return Status(kOk);
   }
+  // Nothing that could have started a navigation in the current frame has
+  // happened since the last check found it idle, so there is no need for
+  // another round trip. The events already received may tell otherwise though,
+  // hence they are processed first.
+  if (known_idle_) {
+    Status status = client_->HandleReceivedEvents();
+    if (status.IsError())
+      return status;
+  }
+  if (known_idle_ && hasCurrentFrame() && loadingState() == kNotLoading) {
+    *is_pending = false;
+    ++skipped_round_trips_;
+    if (ScopedNavigationCommand* command = ScopedNavigationCommand::Current())
+      command->AddSkippedRoundTrip();
+    return Status(kOk);
+  }
+  known_idle_ = false;
+  base::AutoReset<bool> checking_navigation(&checking_navigation_, true);
   // Some DevTools commands (e.g. Input.dispatchMouseEvent) are handled in the
   // browser process, and may cause the renderer process to start a new
   // navigation. We need to call Runtime.evaluate to force a roundtrip to the
@@ -186,6 +228,7 @@ Status NavigationTracker::IsPendingNavigation(const Timeout* timeout,
       return MakeNavigationCheckFailedStatus(status);
   }
   *is_pending = loadingState() == kLoading;
+  known_idle_ = hasCurrentFrame() && loadingState() == kNotLoading;
   return Status(kOk);
 }
 
@@ -207,6 +250,7 @@ Status NavigationTracker::CheckFunctionExists(const Timeout* timeout,
 
 void NavigationTracker::set_timed_out(bool timed_out) {
   timed_out_ = timed_out;
+  known_idle_ = false;
 }
 
 bool NavigationTracker::IsNonBlocking() const {
@@ -214,6 +258,7 @@ bool NavigationTracker::IsNonBlocking() const {
 }
 
 Status NavigationTracker::OnConnected(DevToolsClient* client) {
+  known_idle_ = false;
   clearFrameStates();
   initCurrentFrame(kUnknown);
   // Enable page domain notifications to allow tracking navigation state.
@@ -221,9 +266,28 @@ Status NavigationTracker::OnConnected(DevToolsClient* client) {
   return client_->SendCommand("Page.enable", empty_params);
 }
 
+base::flat_set<std::string> NavigationTracker::GetListenedEventMethods() const {
+  return {
+      "Inspector.targetCrashed",
+      "Page.domContentEventFired",
+      "Page.frameAttached",
+      "Page.frameDetached",
+      "Page.frameStartedLoading",
+      "Page.frameStoppedLoading",
+      "Page.loadEventFired",
+  };
+}
+
 Status NavigationTracker::OnEvent(DevToolsClient* client,
                                   const std::string& method,
                                   const base::DictionaryValue& params) {
+  // Events reporting a finished load cannot make the current frame busy; any
+  // other event may, so the next check has to ask the renderer again.
+  if (method != "Page.loadEventFired" &&
+      method != "Page.domContentEventFired" &&
+      method != "Page.frameStoppedLoading") {
+    known_idle_ = false;
+  }
   if (client->IsMainPage() &&
       (method == "Page.loadEventFired" ||
        (is_eager_ && method == "Page.domContentEventFired"))) {
@@ -330,6 +394,12 @@ Status NavigationTracker::OnCommandSuccess(DevToolsClient* client,
                                            const std::string& method,
                                            const base::DictionaryValue* result,
                                            const Timeout& command_timeout) {
+  if (!checking_navigation_) {
+    ScopedNavigationCommand* command = ScopedNavigationCommand::Current();
+    if (!command || command->can_navigate())
+      known_idle_ = false;
+  }
+
   // Check if Page.navigate has any error from top frame
   std::string error_text;
   if (method == "Page.navigate" && result &&
@@ -24,6 +24,32 @@ class JavaScriptDialogManager;
 class Status;
 class Timeout;
 
+// Describes whether the ChromeDriver command running on the current thread can
+// start a navigation. While a command that cannot navigate is in scope, the
+// DevTools commands it sends leave the known idle state of NavigationTrackers
+// intact. Without a scope, every command is assumed to be able to navigate.
+class ScopedNavigationCommand {
+ public:
+  explicit ScopedNavigationCommand(bool can_navigate);
+  ScopedNavigationCommand(const ScopedNavigationCommand&) = delete;
+  ScopedNavigationCommand& operator=(const ScopedNavigationCommand&) = delete;
+  ~ScopedNavigationCommand();
+
+  // Returns the innermost scope on the current thread, or nullptr.
+  static ScopedNavigationCommand* Current();
+
+  bool can_navigate() const { return can_navigate_; }
+  // Number of renderer round trips skipped by navigation checks while this
+  // scope was active.
+  int skipped_round_trips() const { return skipped_round_trips_; }
+  void AddSkippedRoundTrip() { ++skipped_round_trips_; }
+
+ private:
+  raw_ptr<ScopedNavigationCommand> outer_;
+  const bool can_navigate_;
+  int skipped_round_trips_ = 0;
+};
+
 // Tracks the navigation state of the page.
 class NavigationTracker : public DevToolsEventListener,
                           public PageLoadStrategy {
@@ -57,8 +83,13 @@ class NavigationTracker : public DevToolsEventListener,
 
   Status CheckFunctionExists(const Timeout* timeout, bool* exists);
 
+  // Number of IsPendingNavigation calls answered without a renderer round
+  // trip because the current frame was known to be idle.
+  int skipped_round_trips() const { return skipped_round_trips_; }
+
   // Overridden from DevToolsEventListener:
   Status OnConnected(DevToolsClient* client) override;
+  base::flat_set<std::string> GetListenedEventMethods() const override;
   Status OnEvent(DevToolsClient* client,
                  const std::string& method,
                  const base::DictionaryValue& params) override;
@@ -89,6 +120,13 @@ class NavigationTracker : public DevToolsEventListener,
   raw_ptr<LoadingState> loading_state_;
   // Used when current frame is invalid
   LoadingState dummy_state_;
+  // True when a navigation check confirmed that the current frame is not
+  // loading and neither a navigation event nor a command that may navigate
+  // has been seen since.
+  bool known_idle_ = false;
+  // True while IsPendingNavigation sends its own DevTools commands.
+  bool checking_navigation_ = false;
+  int skipped_round_trips_ = 0;
 };
 
 #endif  // CHROME_TEST_CHROMEDRIVER_CHROME_NAVIGATION_TRACKER_H_
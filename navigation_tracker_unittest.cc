@@ -4,6 +4,7 @@
 
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "base/compiler_specific.h"
 #include "base/json/json_reader.h"
@@ -11,6 +12,7 @@
 #include "base/memory/raw_ptr.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/browser_info.h"
+#include "chrome/test/chromedriver/chrome/devtools_event_listener.h"
 #include "chrome/test/chromedriver/chrome/javascript_dialog_manager.h"
 #include "chrome/test/chromedriver/chrome/navigation_tracker.h"
 #include "chrome/test/chromedriver/chrome/status.h"
@@ -118,6 +120,48 @@ class EvaluateScriptWebView : public StubWebView {
   StatusCode code_;
 };
 
+class CountingRoundTripsDevToolsClient
+    : public DeterminingLoadStateDevToolsClient {
+ public:
+  CountingRoundTripsDevToolsClient()
+      : DeterminingLoadStateDevToolsClient(false, false, std::string(),
+                                           nullptr) {}
+
+  Status SendCommandAndGetResult(const std::string& method,
+                                 const base::DictionaryValue& params,
+                                 base::Value* result) override {
+    if (method == "Runtime.evaluate")
+      round_trips_++;
+    return DeterminingLoadStateDevToolsClient::SendCommandAndGetResult(
+        method, params, result);
+  }
+
+  // Delivers the events received but not processed yet.
+  Status HandleReceivedEvents() override {
+    std::vector<std::string> methods = std::move(received_events_);
+    base::DictionaryValue params;
+    params.GetDict().Set("frameId", GetId());
+    for (const std::string& method : methods) {
+      for (DevToolsEventListener* listener : listeners_) {
+        Status status = listener->OnEvent(this, method, params);
+        if (status.IsError())
+          return status;
+      }
+    }
+    return Status(kOk);
+  }
+
+  void ReceiveEvent(const std::string& method) {
+    received_events_.push_back(method);
+  }
+
+  int round_trips() const { return round_trips_; }
+
+ private:
+  int round_trips_ = 0;
+  std::vector<std::string> received_events_;
+};
+
 }  // namespace
 
 TEST(NavigationTracker, FrameLoadStartStop) {
@@ -608,3 +652,55 @@ TEST(NavigationTracker, TargetClosedInIsPendingNavigation) {
   ASSERT_EQ(kOk, tracker.IsPendingNavigation(nullptr, &is_pending).code());
   ASSERT_TRUE(is_pending);
 }
+
+TEST(NavigationTracker, SkipsRoundTripWhileKnownIdle) {
+  BrowserInfo browser_info;
+  std::unique_ptr<CountingRoundTripsDevToolsClient> client_uptr =
+      std::make_unique<CountingRoundTripsDevToolsClient>();
+  CountingRoundTripsDevToolsClient* client_ptr = client_uptr.get();
+  JavaScriptDialogManager dialog_manager(client_ptr, &browser_info);
+  EvaluateScriptWebView web_view(kOk);
+  NavigationTracker tracker(client_ptr, NavigationTracker::kNotLoading,
+                            &web_view, &browser_info, &dialog_manager);
+
+  // The first check has to ask the renderer, the next one does not.
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(1, client_ptr->round_trips());
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(1, client_ptr->round_trips());
+  ASSERT_EQ(1, tracker.skipped_round_trips());
+
+  // Commands of a non-navigating ChromeDriver command keep the state.
+  {
+    ScopedNavigationCommand navigation_command(false);
+    tracker.OnCommandSuccess(client_ptr, "Runtime.callFunctionOn", nullptr,
+                             Timeout());
+    ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+    ASSERT_EQ(1, client_ptr->round_trips());
+    ASSERT_EQ(1, navigation_command.skipped_round_trips());
+  }
+
+  // Any other command may have started a navigation.
+  tracker.OnCommandSuccess(client_ptr, "Input.dispatchMouseEvent", nullptr,
+                           Timeout());
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(2, client_ptr->round_trips());
+
+  // So may a navigation event, even when the load has finished since.
+  base::DictionaryValue params;
+  params.GetDict().Set("frameId", client_ptr->GetId());
+  tracker.OnEvent(client_ptr, "Page.frameStartedLoading", params);
+  tracker.OnEvent(client_ptr, "Page.frameStoppedLoading", params);
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(3, client_ptr->round_trips());
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(3, client_ptr->round_trips());
+  ASSERT_EQ(3, tracker.skipped_round_trips());
+
+  // Events received but not processed yet are taken into account as well.
+  client_ptr->ReceiveEvent("Page.frameStartedLoading");
+  client_ptr->ReceiveEvent("Page.frameStoppedLoading");
+  ASSERT_NO_FATAL_FAILURE(AssertPendingState(&tracker, false));
+  ASSERT_EQ(4, client_ptr->round_trips());
+  ASSERT_EQ(3, tracker.skipped_round_trips());
+}
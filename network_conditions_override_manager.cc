@@ -30,6 +30,11 @@ Status NetworkConditionsOverrideManager::OnConnected(DevToolsClient* client) {
   return ApplyOverrideIfNeeded();
 }
 
+base::flat_set<std::string>
+NetworkConditionsOverrideManager::GetListenedEventMethods() const {
+  return {"Page.frameNavigated"};
+}
+
 Status NetworkConditionsOverrideManager::OnEvent(
     DevToolsClient* client,
     const std::string& method,
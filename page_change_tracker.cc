@@ -0,0 +1,77 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/test/chromedriver/chrome/page_change_tracker.h"
+
+#include <utility>
+
+#include "base/bind.h"
+#include "base/values.h"
+#include "chrome/test/chromedriver/chrome/devtools_client.h"
+#include "chrome/test/chromedriver/chrome/status.h"
+
+// static
+base::flat_set<std::string> PageChangeTracker::GetContentChangeEvents() {
+  return {"Page.frameAttached",
+          "Page.frameDetached",
+          "Page.frameNavigated",
+          "Page.frameStartedLoading",
+          "Page.javascriptDialogClosed",
+          "Page.javascriptDialogOpening",
+          "Page.loadEventFired",
+          "Page.navigatedWithinDocument",
+          "Runtime.executionContextCreated",
+          "Runtime.executionContextDestroyed",
+          "Runtime.executionContextsCleared",
+          "Target.attachedToTarget",
+          "Target.detachedFromTarget",
+          "Target.targetDestroyed"};
+}
+
+// static
+base::flat_set<std::string> PageChangeTracker::GetExecutionContextEvents() {
+  return {"Runtime.executionContextCreated",
+          "Runtime.executionContextDestroyed",
+          "Runtime.executionContextsCleared"};
+}
+
+namespace {
+
+void RunClosure(const base::RepeatingClosure& closure,
+                DevToolsClient* client,
+                const std::string& method,
+                const base::DictionaryValue& params) {
+  closure.Run();
+}
+
+}  // namespace
+
+PageChangeTracker::PageChangeTracker(base::flat_set<std::string> event_methods,
+                                     base::RepeatingClosure on_page_change)
+    : PageChangeTracker(
+          std::move(event_methods),
+          base::BindRepeating(&RunClosure, std::move(on_page_change))) {}
+
+PageChangeTracker::PageChangeTracker(base::flat_set<std::string> event_methods,
+                                     EventCallback on_event)
+    : event_methods_(std::move(event_methods)),
+      on_event_(std::move(on_event)) {}
+
+PageChangeTracker::~PageChangeTracker() = default;
+
+base::flat_set<std::string> PageChangeTracker::GetListenedEventMethods()
+    const {
+  return event_methods_;
+}
+
+Status PageChangeTracker::OnEvent(DevToolsClient* client,
+                                  const std::string& method,
+                                  const base::DictionaryValue& params) {
+  on_event_.Run(client, method, params);
+  return Status(kOk);
+}
+
+bool PageChangeTracker::subscribes_to_browser() {
+  return true;
+}
@@ -0,0 +1,64 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_TEST_CHROMEDRIVER_CHROME_PAGE_CHANGE_TRACKER_H_
+#define CHROME_TEST_CHROMEDRIVER_CHROME_PAGE_CHANGE_TRACKER_H_
+
+#include <string>
+
+#include "base/callback.h"
+#include "base/containers/flat_set.h"
+#include "chrome/test/chromedriver/chrome/devtools_event_listener.h"
+
+namespace base {
+class DictionaryValue;
+}
+
+class DevToolsClient;
+class Status;
+
+// Runs a callback whenever one of the given events, which signal some change
+// of a page, is received.
+class PageChangeTracker : public DevToolsEventListener {
+ public:
+  // Events signaling that the content of a page may have changed:
+  // navigations, new execution contexts, dialogs and attached or detached
+  // targets. These are the events that NavigationTracker and FrameTracker
+  // follow. Changes made by the page scripts are not signaled, the DOM domain
+  // is not enabled.
+  static base::flat_set<std::string> GetContentChangeEvents();
+  // Events signaling that an execution context was created or destroyed, i.e.
+  // that state ChromeDriver left in a JavaScript context may have been lost.
+  static base::flat_set<std::string> GetExecutionContextEvents();
+
+  using EventCallback =
+      base::RepeatingCallback<void(DevToolsClient* client,
+                                   const std::string& method,
+                                   const base::DictionaryValue& params)>;
+
+  PageChangeTracker(base::flat_set<std::string> event_methods,
+                    base::RepeatingClosure on_page_change);
+  // Runs |on_event| with the received events instead, so that it can tell
+  // which page or frame changed.
+  PageChangeTracker(base::flat_set<std::string> event_methods,
+                    EventCallback on_event);
+
+  PageChangeTracker(const PageChangeTracker&) = delete;
+  PageChangeTracker& operator=(const PageChangeTracker&) = delete;
+
+  ~PageChangeTracker() override;
+
+  // Overridden from DevToolsEventListener:
+  base::flat_set<std::string> GetListenedEventMethods() const override;
+  Status OnEvent(DevToolsClient* client,
+                 const std::string& method,
+                 const base::DictionaryValue& params) override;
+  bool subscribes_to_browser() override;
+
+ private:
+  const base::flat_set<std::string> event_methods_;
+  EventCallback on_event_;
+};
+
+#endif  // CHROME_TEST_CHROMEDRIVER_CHROME_PAGE_CHANGE_TRACKER_H_
@@ -24,6 +24,10 @@ Status PageTracker::OnConnected(DevToolsClient* client) {
   return Status(kOk);
 }
 
+base::flat_set<std::string> PageTracker::GetListenedEventMethods() const {
+  return {"Target.detachedFromTarget"};
+}
+
 Status PageTracker::OnEvent(DevToolsClient* client,
                             const std::string& method,
                             const base::DictionaryValue& params) {
@@ -185,13 +185,11 @@ Status PerformanceLogger::EnableInspectorDomains(DevToolsClient* client) {
                                  !client->GetOwner()->IsServiceWorker())) {
     enable_commands.push_back("Page.enable");
   }
-  for (const auto& enable_command : enable_commands) {
-    base::DictionaryValue params;  // All the enable commands have empty params.
-    Status status = client->SendCommand(enable_command, params);
-    if (status.IsError())
-      return status;
-  }
-  return Status(kOk);
+  base::DictionaryValue params;  // All the enable commands have empty params.
+  std::vector<DevToolsClient::BatchCommand> batch;
+  for (const auto& enable_command : enable_commands)
+    batch.push_back({enable_command, &params});
+  return client->SendCommandBatch(batch, nullptr);
 }
 
 Status PerformanceLogger::HandleInspectorEvents(
@@ -4,10 +4,11 @@
 
 #include "chrome/test/chromedriver/session.h"
 
+#include <limits>
 #include <list>
 #include <utility>
 
-#include "base/json/json_reader.h"
+#include "base/containers/cxx20_erase.h"
 #include "base/json/json_writer.h"
 #include "base/lazy_instance.h"
 #include "base/logging.h"
@@ -17,12 +18,24 @@
 #include "chrome/test/chromedriver/chrome/status.h"
 #include "chrome/test/chromedriver/chrome/web_view.h"
 #include "chrome/test/chromedriver/logging.h"
+#include "chrome/test/chromedriver/util.h"
 
 namespace {
 
 base::LazyInstance<base::ThreadLocalPointer<Session>>::DestructorAtExit
     lazy_tls_session = LAZY_INSTANCE_INITIALIZER;
 
+// Key of the dropped command responses in Session::GetBidiQueueStats.
+const char kDroppedBidiResponse[] = "(response)";
+
+base::Value::Dict DroppedBidiMessagesToValue(
+    const std::map<std::string, int>& dropped_messages) {
+  base::Value::Dict dropped;
+  for (const auto& [method, count] : dropped_messages)
+    dropped.Set(method, count);
+  return dropped;
+}
+
 }  // namespace
 
 FrameInfo::FrameInfo(const std::string& parent_frame_id,
@@ -32,6 +45,48 @@ FrameInfo::FrameInfo(const std::string& parent_frame_id,
       frame_id(frame_id),
       chromedriver_frame_id(chromedriver_frame_id) {}
 
+InstalledAtoms::InstalledAtoms() = default;
+
+InstalledAtoms::InstalledAtoms(const InstalledAtoms& other) = default;
+
+InstalledAtoms::~InstalledAtoms() = default;
+
+CommandLatencyMetrics::CommandLatencyMetrics() = default;
+
+CommandLatencyMetrics::CommandLatencyMetrics(
+    const CommandLatencyMetrics& other) = default;
+
+CommandLatencyMetrics& CommandLatencyMetrics::operator=(
+    const CommandLatencyMetrics& other) = default;
+
+CommandLatencyMetrics::~CommandLatencyMetrics() = default;
+
+void CommandLatencyMetrics::Merge(const CommandLatencyMetrics& other) {
+  queueing.Merge(other.queueing);
+  execution.Merge(other.execution);
+  devtools_wait.Merge(other.devtools_wait);
+  skipped_navigation_checks += other.skipped_navigation_checks;
+}
+
+base::Value::Dict CommandLatencyMetrics::ToValue() const {
+  base::Value::Dict dict;
+  dict.Set("queueing", queueing.ToValue());
+  dict.Set("execution", execution.ToValue());
+  dict.Set("devtoolsWait", devtools_wait.ToValue());
+  dict.Set("skippedNavigationChecks", skipped_navigation_checks);
+  return dict;
+}
+
+CoalescedRead::CoalescedRead(base::Value value,
+                             base::TimeTicks completion_time)
+    : value(std::move(value)), completion_time(completion_time) {}
+
+CoalescedRead::CoalescedRead(CoalescedRead&& other) = default;
+
+CoalescedRead& CoalescedRead::operator=(CoalescedRead&& other) = default;
+
+CoalescedRead::~CoalescedRead() = default;
+
 InputCancelListEntry::InputCancelListEntry(base::DictionaryValue* input_state,
                                            const MouseEvent* mouse_event,
                                            const TouchEvent* touch_event,
@@ -71,7 +126,8 @@ BidiConnection& BidiConnection::operator=(BidiConnection&& other) = default;
 const base::TimeDelta Session::kDefaultImplicitWaitTimeout = base::Seconds(0);
 const base::TimeDelta Session::kDefaultPageLoadTimeout = base::Seconds(300);
 const base::TimeDelta Session::kDefaultScriptTimeout = base::Seconds(30);
-const int kBidiQueueCapacity = 20;
+const size_t Session::kDefaultBidiQueueCapacity = 20;
+const int Session::kFirstRoutedBidiCommandId = 1 << 30;
 
 Session::Session(const std::string& id)
     : id(id),
@@ -164,25 +220,74 @@ bool Session::BidiMapperIsLaunched() const {
 }
 
 void Session::OnBidiResponse(const std::string& payload) {
-  absl::optional<base::Value> payload_parsed =
-      base::JSONReader::Read(payload, base::JSON_PARSE_CHROMIUM_EXTENSIONS);
-  if (!payload_parsed || !payload_parsed->is_dict()) {
+  // The payload is forwarded as is, only the fields needed to route it are
+  // read.
+  BidiMessageHeader header;
+  if (!PeekBidiMessage(payload, &header)) {
     LOG(WARNING) << "BiDi response is not a map: " << payload;
     return;
   }
 
-  if (payload_parsed->GetDict().FindBool("launched").value_or(false)) {
+  if (header.launched) {
     bidi_mapper_is_launched_ = true;
     return;
   }
 
-  // If there is no active bidi connections the events will be accumulated.
-  bidi_response_queue_.push(std::move(*payload_parsed));
-  for (; bidi_response_queue_.size() > kBidiQueueCapacity;
-       bidi_response_queue_.pop()) {
-    LOG(WARNING) << "BiDi response queue overflow, dropping the message: "
-                 << bidi_response_queue_.front();
+  if (header.id && *header.id == awaited_bidi_response_id)
+    awaited_bidi_response_id = -1;
+
+  auto unsubscribe = header.id ? pending_bidi_unsubscribes.find(*header.id)
+                               : pending_bidi_unsubscribes.end();
+  if (unsubscribe != pending_bidi_unsubscribes.end()) {
+    if (!header.error)
+      accepted_bidi_unsubscribes.push_back(std::move(unsubscribe->second));
+    pending_bidi_unsubscribes.erase(unsubscribe);
+  }
+
+  auto route = header.id ? bidi_command_routes_.find(*header.id)
+                         : bidi_command_routes_.end();
+  if (route != bidi_command_routes_.end()) {
+    BidiCommandRoute command_route = route->second;
+    bidi_command_routes_.erase(route);
+    std::string response = payload;
+    if (!SetBidiMessageId(header, command_route.command_id, &response)) {
+      LOG(WARNING) << "Cannot restore the id of BiDi response: " << payload;
+      return;
+    }
+    // The response is dropped if its connection was closed meanwhile.
+    for (const BidiConnection& conn : bidi_connections_) {
+      if (conn.connection_id == command_route.connection_id)
+        conn.send_response.Run(response);
+    }
+    return;
+  }
+  if (header.id && *header.id >= kFirstRoutedBidiCommandId) {
+    // The route was forgotten because its connection was closed.
+    VLOG(0) << "Dropping BiDi response without a route: " << payload;
+    return;
   }
+
+  // Events are stored once and read by every connection. If there is no
+  // active bidi connections they will be accumulated.
+  std::string method = header.method.value_or(std::string());
+  if (bidi_connections_.empty() &&
+      bidi_messages_.size() >= bidi_queue_capacity) {
+    if (!bidi_queue_overflow_logged_) {
+      LOG(WARNING) << "BiDi message queue is full, applying the '"
+                   << bidi_queue_policy << "' policy until a connection is "
+                   << "created";
+      bidi_queue_overflow_logged_ = true;
+    }
+    if (bidi_queue_policy == kBidiQueueDropNewest) {
+      DropBidiMessage(method);
+      return;
+    }
+    DCHECK_EQ(kBidiQueueDropOldest, bidi_queue_policy);
+    DropBidiMessage(bidi_messages_.front().method);
+    bidi_messages_.pop_front();
+    ++bidi_messages_start_;
+  }
+  bidi_messages_.push_back({payload, std::move(method)});
   ProcessBidiResponseQueue();
 }
 
@@ -191,6 +296,8 @@ void Session::AddBidiConnection(int connection_id,
                                 CloseFunc close_connection) {
   bidi_connections_.emplace_back(connection_id, std::move(send_response),
                                  std::move(close_connection));
+  bidi_connections_.back().next_message = bidi_messages_start_;
+  ReportDroppedBidiMessages(bidi_connections_.back());
   ProcessBidiResponseQueue();
 }
 
@@ -204,37 +311,82 @@ void Session::RemoveBidiConnection(int connection_id) {
   if (it != bidi_connections_.end()) {
     bidi_connections_.erase(it);
   }
+  base::EraseIf(bidi_command_routes_, [connection_id](const auto& route) {
+    return route.second.connection_id == connection_id;
+  });
+}
+
+int Session::RouteBidiCommand(int connection_id, int command_id) {
+  int routed_id = kFirstRoutedBidiCommandId + next_bidi_command_route_;
+  next_bidi_command_route_ =
+      (next_bidi_command_route_ + 1) %
+      (std::numeric_limits<int>::max() - kFirstRoutedBidiCommandId + 1);
+  bidi_command_routes_[routed_id] = {connection_id, command_id};
+  return routed_id;
+}
+
+void Session::ForgetBidiCommandRoute(int routed_id) {
+  bidi_command_routes_.erase(routed_id);
+}
+
+void Session::ForgetBidiCommandRoutes() {
+  bidi_command_routes_.clear();
 }
 
 void Session::ProcessBidiResponseQueue() {
-  if (bidi_connections_.empty() || bidi_response_queue_.empty()) {
+  if (bidi_connections_.empty()) {
     return;
   }
-  // Only single websocket connection is supported now.
-  DCHECK(bidi_connections_.size() == 1);
-  for (; !bidi_response_queue_.empty(); bidi_response_queue_.pop()) {
-    // TODO(chromedriver:4179): In the future we will support multiple
-    // connections. The payload will have to be parsed and routed to the
-    // appropriate connection. The events will have to be delivered to all
-    // connections.
-    base::Value response_parsed = std::move(bidi_response_queue_.front());
-    std::string response;
-    if (!base::JSONWriter::Write(response_parsed, &response)) {
-      LOG(WARNING) << "unable to serialize a BiDi response";
-      continue;
-    }
-    for (const BidiConnection& conn : bidi_connections_) {
+  uint64_t end = bidi_messages_start_ + bidi_messages_.size();
+  for (BidiConnection& conn : bidi_connections_) {
+    for (; conn.next_message < end; ++conn.next_message) {
       // If the callback fails (asynchronously) because the connection was
       // broken we simply ignore this fact as the message cannot be delivered
       // over that connection anyway.
-      conn.send_response.Run(response);
-      absl::optional<int> response_id = response_parsed.GetDict().FindInt("id");
-      if (response_id && *response_id == awaited_bidi_response_id) {
-        awaited_bidi_response_id = -1;
-        // No "id" means that we are dealing with an event
-      }
+      conn.send_response.Run(
+          bidi_messages_[conn.next_message - bidi_messages_start_].payload);
     }
   }
+  // Every connection has read all the messages.
+  bidi_messages_start_ = end;
+  bidi_messages_.clear();
+  bidi_queue_overflow_logged_ = false;
+}
+
+void Session::DropBidiMessage(const std::string& method) {
+  ++dropped_bidi_messages_[method.empty() ? kDroppedBidiResponse : method];
+  ++unreported_bidi_drops_;
+}
+
+void Session::ReportDroppedBidiMessages(const BidiConnection& conn) {
+  if (!unreported_bidi_drops_)
+    return;
+  base::Value::Dict dropped =
+      DroppedBidiMessagesToValue(dropped_bidi_messages_);
+  std::string dropped_json;
+  base::JSONWriter::Write(dropped, &dropped_json);
+  LOG(WARNING) << "Dropped " << unreported_bidi_drops_
+               << " BiDi messages while no connection was open: "
+               << dropped_json;
+  unreported_bidi_drops_ = 0;
+
+  base::Value::Dict params;
+  params.Set("dropped", std::move(dropped));
+  base::Value::Dict event;
+  event.Set("method", "goog:chromedriver.droppedMessages");
+  event.Set("params", std::move(params));
+  std::string payload;
+  base::JSONWriter::Write(event, &payload);
+  conn.send_response.Run(payload);
+}
+
+base::Value::Dict Session::GetBidiQueueStats() const {
+  base::Value::Dict stats;
+  stats.Set("capacity", static_cast<int>(bidi_queue_capacity));
+  stats.Set("policy", bidi_queue_policy);
+  stats.Set("queued", static_cast<int>(bidi_messages_.size()));
+  stats.Set("dropped", DroppedBidiMessagesToValue(dropped_bidi_messages_));
+  return stats;
 }
 
 void Session::CloseAllConnections() {
@@ -245,6 +397,22 @@ void Session::CloseAllConnections() {
   }
 }
 
+void Session::InvalidateCoalescedReads() {
+  coalesced_reads.clear();
+  ++coalesced_reads_generation;
+}
+
+void Session::ForgetInstalledAtoms(const std::string& web_view_id,
+                                   const std::string& frame) {
+  installed_atoms.erase(std::make_pair(web_view_id, frame));
+}
+
+void Session::ForgetInstalledAtoms(const std::string& web_view_id) {
+  base::EraseIf(installed_atoms, [&web_view_id](const auto& entry) {
+    return entry.first.first == web_view_id;
+  });
+}
+
 Session* GetThreadLocalSession() {
   return lazy_tls_session.Pointer()->Get();
 }
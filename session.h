@@ -5,17 +5,23 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_SESSION_H_
 #define CHROME_TEST_CHROMEDRIVER_SESSION_H_
 
+#include <stdint.h>
+
 #include <list>
+#include <map>
 #include <memory>
-#include <queue>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/callback.h"
+#include "base/containers/circular_deque.h"
 #include "base/memory/raw_ptr.h"
 #include "base/time/time.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/basic_types.h"
+#include "chrome/test/chromedriver/chrome/cdp_metrics.h"
 #include "chrome/test/chromedriver/chrome/device_metrics.h"
 #include "chrome/test/chromedriver/chrome/geoposition.h"
 #include "chrome/test/chromedriver/chrome/network_conditions.h"
@@ -29,6 +35,11 @@ static const char kDismiss[] = "dismiss";
 static const char kDismissAndNotify[] = "dismiss and notify";
 static const char kIgnore[] = "ignore";
 
+// What to do with the BiDi messages that arrive while the queue of a session
+// without connections is full.
+static const char kBidiQueueDropOldest[] = "dropOldest";
+static const char kBidiQueueDropNewest[] = "dropNewest";
+
 // Controls whether ChromeDriver operates in W3C mode (when true) by default
 // or legacy mode (when false).
 static const bool kW3CDefault = true;
@@ -52,6 +63,19 @@ struct FrameInfo {
   std::string chromedriver_frame_id;
 };
 
+// Atoms installed in the page-side registry of an execution context, see
+// CallAtomsJs.
+struct InstalledAtoms {
+  InstalledAtoms();
+  InstalledAtoms(const InstalledAtoms& other);
+  ~InstalledAtoms();
+
+  // Random name of the window property holding the registry. A new context
+  // gets a new one, so that its pages cannot know it in advance.
+  std::string registry_key;
+  std::set<std::string> atom_ids;
+};
+
 struct InputCancelListEntry {
   InputCancelListEntry(base::DictionaryValue* input_state,
                        const MouseEvent* mouse_event,
@@ -81,12 +105,54 @@ struct BidiConnection {
   int connection_id;
   SendTextFunc send_response;
   CloseFunc close_connection;
+  // Sequence number of the next shared BiDi message to send over the
+  // connection.
+  uint64_t next_message = 0;
+};
+
+// Latencies of the executions of a ChromeDriver command.
+struct CommandLatencyMetrics {
+  CommandLatencyMetrics();
+  CommandLatencyMetrics(const CommandLatencyMetrics& other);
+  CommandLatencyMetrics& operator=(const CommandLatencyMetrics& other);
+  ~CommandLatencyMetrics();
+
+  void Merge(const CommandLatencyMetrics& other);
+  // Returns {"queueing", "execution", "devtoolsWait",
+  // "skippedNavigationChecks"}.
+  base::Value::Dict ToValue() const;
+
+  // Time between the arrival of the command on the command thread and the
+  // start of its execution on the session thread.
+  LatencyHistogram queueing;
+  // Time spent executing the command on the session thread.
+  LatencyHistogram execution;
+  // Part of the execution spent blocked waiting for messages from DevTools.
+  LatencyHistogram devtools_wait;
+  // Renderer round trips avoided by navigation checks known to be idle.
+  int skipped_navigation_checks = 0;
+};
+
+// Result of a read-only command, shared with the identical commands that were
+// queued while it was running.
+struct CoalescedRead {
+  CoalescedRead(base::Value value, base::TimeTicks completion_time);
+  CoalescedRead(CoalescedRead&& other);
+  CoalescedRead& operator=(CoalescedRead&& other);
+  ~CoalescedRead();
+
+  base::Value value;
+  base::TimeTicks completion_time;
 };
 
 struct Session {
   static const base::TimeDelta kDefaultImplicitWaitTimeout;
   static const base::TimeDelta kDefaultPageLoadTimeout;
   static const base::TimeDelta kDefaultScriptTimeout;
+  static const size_t kDefaultBidiQueueCapacity;
+  // Routed BiDi commands are forwarded with ids from this one up, unrouted
+  // commands must use lower ids.
+  static const int kFirstRoutedBidiCommandId;
 
   explicit Session(const std::string& id);
   Session(const std::string& id, std::unique_ptr<Chrome> chrome);
@@ -107,8 +173,30 @@ struct Session {
   void AddBidiConnection(int connection_id,
                          SendTextFunc send_response,
                          CloseFunc close_connection);
+  // Also forgets the routes of the pending commands of the connection.
   void RemoveBidiConnection(int connection_id);
+  // Returns the id to forward the BiDi command |command_id| of the connection
+  // |connection_id| with, so that its response is sent back over that
+  // connection only and with the original id.
+  int RouteBidiCommand(int connection_id, int command_id);
+  // Forgets the route of the BiDi command forwarded with |routed_id|, e.g.
+  // when it could not be forwarded after all.
+  void ForgetBidiCommandRoute(int routed_id);
+  // Forgets the routes of all the pending BiDi commands, e.g. when the
+  // BiDiMapper is gone and will not respond to them.
+  void ForgetBidiCommandRoutes();
+  // Returns {"capacity", "policy", "queued", "dropped"}, where "dropped" is
+  // the number of BiDi messages dropped from the queue keyed by the event
+  // method.
+  base::Value::Dict GetBidiQueueStats() const;
   void CloseAllConnections();
+  // Drops the results in |coalesced_reads|.
+  void InvalidateCoalescedReads();
+  // Forgets the atoms installed in |frame| of the web view |web_view_id|.
+  void ForgetInstalledAtoms(const std::string& web_view_id,
+                            const std::string& frame);
+  // Forgets the atoms installed in all frames of the web view |web_view_id|.
+  void ForgetInstalledAtoms(const std::string& web_view_id);
 
   const std::string id;
   bool w3c_compliant;
@@ -162,22 +250,79 @@ struct Session {
   int click_count;
   base::TimeTicks mouse_click_timestamp;
   std::string host;
+  // Keyed by the command name.
+  std::map<std::string, CommandLatencyMetrics> command_latencies;
+  // Whether identical read-only commands share results, see
+  // Capabilities::coalesce_reads.
+  bool coalesce_reads = false;
+  // Results of read-only commands, keyed by the command, its target and its
+  // parameters. They are dropped when the page changes or another command
+  // runs.
+  std::map<std::string, CoalescedRead> coalesced_reads;
+  // Incremented whenever |coalesced_reads| is invalidated.
+  int coalesced_reads_generation = 0;
+  // See Capabilities::observe_element_waits.
+  bool observe_element_waits = false;
+  // Number of BiDi messages kept while there is no connection, and the
+  // kBidiQueue* policy applied once they overflow.
+  size_t bidi_queue_capacity = kDefaultBidiQueueCapacity;
+  std::string bidi_queue_policy = kBidiQueueDropOldest;
+  // Browsing contexts subscribed to each BiDi event or module with
+  // session.subscribe, an empty context standing for all of them. The events
+  // of the other modules are dropped in the BiDiMapper tab.
+  std::map<std::string, std::set<std::string>> bidi_subscriptions;
+  // session.unsubscribe commands forwarded to the BiDiMapper, keyed by the id
+  // they were forwarded with. Those the BiDiMapper accepted are moved to
+  // |accepted_bidi_unsubscribes| and applied to |bidi_subscriptions| before
+  // the next BiDi command is forwarded.
+  std::map<int, std::string> pending_bidi_unsubscribes;
+  std::vector<std::string> accepted_bidi_unsubscribes;
+  // Atoms installed in the execution contexts of the pages, keyed by the web
+  // view and the frame, so that CallAtomsJs can call them without sending
+  // their source. Forgotten when the execution context of the frame changes.
+  std::map<std::pair<std::string, std::string>, InstalledAtoms>
+      installed_atoms;
+  // Random token required to add atoms to the page-side registries.
+  std::string atom_registry_secret;
 
  private:
   void SwitchFrameInternal(bool for_top_frame);
   void ProcessBidiResponseQueue();
+  void DropBidiMessage(const std::string& method);
+  void ReportDroppedBidiMessages(const BidiConnection& conn);
 
-  // TODO: for the moment being we support single connection per client
-  // In the future (2022Q4) we will probably support multiple bidi connections.
-  // In order to do that we can try either of the following approaches:
-  // * Create a separate CDP session per connection
-  // * Give some connection identifying context to the BiDiMapper.
-  //   The context will travel between the BiDiMapper and ChromeDriver.
-  // * Store an internal map between CDP command id and connection.
   std::vector<BidiConnection> bidi_connections_;
-  // If there is no active connections the messages from Chrome are accumulated
-  // in this queue until a connection is created or the queue overflows.
-  std::queue<base::Value> bidi_response_queue_;
+  // A message from the BiDiMapper, kept as received.
+  struct BidiResponse {
+    std::string payload;
+    // Empty for command responses.
+    std::string method;
+  };
+  // Messages from the BiDiMapper that go to all the connections: events and
+  // responses to commands that were not routed. Every connection reads them
+  // through its BidiConnection::next_message cursor. Messages read by all the
+  // connections are dropped; without connections they are accumulated until
+  // a connection is created or the buffer overflows.
+  base::circular_deque<BidiResponse> bidi_messages_;
+  // Sequence number of the front of |bidi_messages_|.
+  uint64_t bidi_messages_start_ = 0;
+  // Number of messages dropped from |bidi_messages_| keyed by the event
+  // method, and how many of them are yet to be reported to a connection.
+  std::map<std::string, int> dropped_bidi_messages_;
+  int unreported_bidi_drops_ = 0;
+  // Whether the overflow of |bidi_messages_| has been logged since the
+  // messages were last read.
+  bool bidi_queue_overflow_logged_ = false;
+  // Connection and original id of a BiDi command forwarded to the BiDiMapper.
+  struct BidiCommandRoute {
+    int connection_id;
+    int command_id;
+  };
+  // Routes of the pending BiDi commands, keyed by the id they were forwarded
+  // with.
+  std::map<int, BidiCommandRoute> bidi_command_routes_;
+  // Offset of the next routed id from kFirstRoutedBidiCommandId.
+  int next_bidi_command_route_ = 0;
 };
 
 Session* GetThreadLocalSession();
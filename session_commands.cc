@@ -8,6 +8,7 @@
 #include <memory>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/callback.h"
@@ -15,6 +16,7 @@
 #include "base/files/file_util.h"
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
+#include "base/json/string_escape.h"
 #include "base/logging.h"  // For CHECK macros.
 #include "base/memory/ref_counted.h"
 #include "base/strings/string_util.h"
@@ -35,10 +37,13 @@
 #include "chrome/test/chromedriver/chrome/chrome_desktop_impl.h"
 #include "chrome/test/chromedriver/chrome/chrome_impl.h"
 #include "chrome/test/chromedriver/chrome/device_manager.h"
+#include "chrome/test/chromedriver/chrome/devtools_client.h"
 #include "chrome/test/chromedriver/chrome/devtools_client_impl.h"
 #include "chrome/test/chromedriver/chrome/devtools_event_listener.h"
 #include "chrome/test/chromedriver/chrome/geoposition.h"
 #include "chrome/test/chromedriver/chrome/javascript_dialog_manager.h"
+#include "chrome/test/chromedriver/chrome/log.h"
+#include "chrome/test/chromedriver/chrome/page_change_tracker.h"
 #include "chrome/test/chromedriver/chrome/status.h"
 #include "chrome/test/chromedriver/chrome/web_view.h"
 #include "chrome/test/chromedriver/chrome_launcher.h"
@@ -67,6 +72,12 @@ const int k3GThroughput = 750 * 1024;
 const int k2GLatency = 300;
 const int k2GThroughput = 250 * 1024;
 
+// The browser-wide client also routes the messages of all the page clients.
+DevToolsClientImpl* GetBrowserwideClient(Session* session) {
+  ChromeImpl* chrome = static_cast<ChromeImpl*>(session->chrome.get());
+  return static_cast<DevToolsClientImpl*>(chrome->Client());
+}
+
 Status EvaluateScriptAndIgnoreResult(Session* session,
                                      std::string expression,
                                      const bool awaitPromise = false) {
@@ -88,6 +99,103 @@ Status EvaluateScriptAndIgnoreResult(Session* session,
   return web_view->EvaluateScript(frame_id, expression, awaitPromise, &result);
 }
 
+// Drops the BiDi events that no session.subscribe command asked for in the
+// BiDiMapper tab, before they are sent to ChromeDriver.
+// Only events have a "method" member in the outer object of the message: the
+// filter looks for the first one without parsing the message, and lets the
+// message through if anything, e.g. a nested object, precedes it.
+const char kBidiEventFilterScript[] = R"((function() {
+  const send = window.sendBidiResponse;
+  const subscribed = new Set();
+  window[Symbol.for('chromedriver.bidiSubscriptions')] = subscribed;
+  const methodKey = '"method":"';
+  window.sendBidiResponse = function(payload) {
+    const start = payload.indexOf(methodKey);
+    if (start > 0 && payload.lastIndexOf('{', start) === 0 &&
+        payload.lastIndexOf('[', start) < 0) {
+      const methodStart = start + methodKey.length;
+      const method =
+          payload.substring(methodStart, payload.indexOf('"', methodStart));
+      const dot = method.indexOf('.');
+      if (!subscribed.has(method) &&
+          !subscribed.has(dot < 0 ? method : method.substring(0, dot))) {
+        return;
+      }
+    }
+    send(payload);
+  };
+})())";
+
+const char kSetBidiSubscriptionsFunction[] = R"(function(events) {
+  const subscribed = window[Symbol.for('chromedriver.bidiSubscriptions')];
+  subscribed.clear();
+  for (const event of events)
+    subscribed.add(event);
+})";
+
+// Applies the BiDi session.subscribe or session.unsubscribe |command| to
+// Session::bidi_subscriptions. Malformed commands are left for the BiDiMapper
+// to reject.
+void ApplyBidiSubscriptionCommand(Session* session,
+                                  bool subscribe,
+                                  const std::string& command) {
+  absl::optional<base::Value> parsed = base::JSONReader::Read(command);
+  const base::Value::Dict* params =
+      parsed && parsed->is_dict() ? parsed->GetDict().FindDict("params")
+                                  : nullptr;
+  const base::Value::List* events =
+      params ? params->FindList("events") : nullptr;
+  if (!events)
+    return;
+
+  // An empty context stands for all the browsing contexts.
+  std::vector<std::string> contexts;
+  if (const base::Value::List* context_list = params->FindList("contexts")) {
+    for (const base::Value& context : *context_list) {
+      if (context.is_string())
+        contexts.push_back(context.GetString());
+    }
+  }
+  if (contexts.empty())
+    contexts.emplace_back();
+
+  for (const base::Value& event : *events) {
+    if (!event.is_string())
+      continue;
+    if (subscribe) {
+      session->bidi_subscriptions[event.GetString()].insert(contexts.begin(),
+                                                             contexts.end());
+      continue;
+    }
+    auto it = session->bidi_subscriptions.find(event.GetString());
+    if (it == session->bidi_subscriptions.end())
+      continue;
+    for (const std::string& context : contexts)
+      it->second.erase(context);
+    if (it->second.empty())
+      session->bidi_subscriptions.erase(it);
+  }
+}
+
+// Sets the event filter of the BiDiMapper tab to Session::bidi_subscriptions.
+Status SetBidiEventFilter(Session* session, WebView* web_view) {
+  base::Value::List subscribed_events;
+  for (const auto& [event, event_contexts] : session->bidi_subscriptions)
+    subscribed_events.Append(event);
+  base::Value::List args;
+  args.Append(std::move(subscribed_events));
+  std::unique_ptr<base::Value> result;
+  return web_view->CallFunction(std::string(), kSetBidiSubscriptionsFunction,
+                                args, &result);
+}
+
+// Forgets the BiDi command |cmd_id| that was not forwarded to the BiDiMapper,
+// since no response will come for it.
+void ForgetUnforwardedBidiCommand(Session* session, int cmd_id) {
+  session->ForgetBidiCommandRoute(cmd_id);
+  session->pending_bidi_unsubscribes.erase(cmd_id);
+}
+
 void InitSessionForWebSocketConnection(SessionConnectionMap* session_map,
                                        std::string session_id) {
   session_map->insert({session_id, -1});
@@ -286,6 +394,39 @@ Status CheckSessionCreated(Session* session) {
   return Status(kOk);
 }
 
+// Forgets the atoms installed in the execution contexts that the event
+// |method| signals as replaced in the page of |client|.
+void ForgetAtomsOfReplacedContexts(Session* session,
+                                   DevToolsClient* client,
+                                   const std::string& method,
+                                   const base::DictionaryValue& params) {
+  if (method == "Runtime.executionContextsCleared") {
+    session->ForgetInstalledAtoms(client->GetId());
+    return;
+  }
+  // A destroyed context is either replaced by a created one, or belongs to a
+  // detached frame. A context changed before its events are handled is
+  // detected by CallAtomsJs.
+  if (method != "Runtime.executionContextCreated")
+    return;
+  const base::Value::Dict* aux_data =
+      params.GetDict().FindDictByDottedPath("context.auxData");
+  const std::string* frame_id =
+      aux_data ? aux_data->FindString("frameId") : nullptr;
+  if (!frame_id) {
+    session->ForgetInstalledAtoms(client->GetId());
+    return;
+  }
+  // The atoms are only installed in the main world of the frames.
+  if (!aux_data->FindBool("isDefault").value_or(true))
+    return;
+  // The session refers to the main frame, whose id is the one of the target,
+  // as the empty frame.
+  session->ForgetInstalledAtoms(
+      client->GetId(),
+      *frame_id == client->GetId() ? std::string() : *frame_id);
+}
+
 Status InitSessionHelper(const InitSessionParams& bound_params,
                          Session* session,
                          const base::DictionaryValue& params,
@@ -315,6 +456,23 @@ Status InitSessionHelper(const InitSessionParams& bound_params,
   // |session| will own the |CommandListener|s.
   session->command_listeners.swap(command_listeners);
 
+  if (capabilities.log_storage_limit) {
+    base::FilePath spill_dir;
+    if (capabilities.spill_logs_to_disk) {
+      if (!session->temp_dir.IsValid() &&
+          !session->temp_dir.CreateUniqueTempDir()) {
+        return Status(kUnknownError, "unable to create temp dir");
+      }
+      if (!base::CreateTemporaryDirInDir(session->temp_dir.GetPath(),
+                                         FILE_PATH_LITERAL("logs"),
+                                         &spill_dir)) {
+        return Status(kUnknownError, "unable to create temp dir");
+      }
+    }
+    for (WebDriverLog* log : session->GetAllLogs())
+      log->SetStorageLimit(capabilities.log_storage_limit, spill_dir);
+  }
+
   if (session->webSocketUrl) {
     BidiTracker* bidi_tracker = new BidiTracker();
     bidi_tracker->SetBidiCallback(base::BindRepeating(
@@ -322,6 +480,18 @@ Status InitSessionHelper(const InitSessionParams& bound_params,
     devtools_event_listeners.emplace_back(bidi_tracker);
   }
 
+  if (session->coalesce_reads) {
+    devtools_event_listeners.push_back(std::make_unique<PageChangeTracker>(
+        PageChangeTracker::GetContentChangeEvents(),
+        base::BindRepeating(&Session::InvalidateCoalescedReads,
+                            base::Unretained(session))));
+  }
+
+  devtools_event_listeners.push_back(std::make_unique<PageChangeTracker>(
+      PageChangeTracker::GetExecutionContextEvents(),
+      base::BindRepeating(&ForgetAtomsOfReplacedContexts,
+                          base::Unretained(session))));
+
   status =
       LaunchChrome(bound_params.url_loader_factory, bound_params.socket_factory,
                    bound_params.device_manager, capabilities,
@@ -388,6 +558,10 @@ Status InitSessionHelper(const InitSessionParams& bound_params,
           "Runtime.addBinding", base::Value::AsDictionaryValue(body), &result);
     }
 
+    status = EvaluateScriptAndIgnoreResult(session, kBidiEventFilterScript);
+    if (status.IsError())
+      return status;
+
     status = EvaluateScriptAndIgnoreResult(session, kMapperScript);
     if (status.IsError())
       return status;
@@ -490,6 +664,12 @@ Status ConfigureSession(Session* session,
   session->strict_file_interactability =
       capabilities->strict_file_interactability;
   session->webSocketUrl = capabilities->webSocketUrl;
+  session->coalesce_reads = capabilities->coalesce_reads;
+  session->observe_element_waits = capabilities->observe_element_waits;
+  if (capabilities->bidi_queue_capacity)
+    session->bidi_queue_capacity = capabilities->bidi_queue_capacity;
+  if (!capabilities->bidi_queue_policy.empty())
+    session->bidi_queue_policy = capabilities->bidi_queue_policy;
   Log::Level driver_level = Log::kWarning;
   if (capabilities->logging_prefs.count(WebDriverLog::kDriverType))
     driver_level = capabilities->logging_prefs[WebDriverLog::kDriverType];
@@ -741,6 +921,11 @@ Status ExecuteQuit(bool allow_detach,
                    const base::DictionaryValue& params,
                    std::unique_ptr<base::Value>* value) {
   session->quit = true;
+  if (GetLogLevel() == Log::kAll) {
+    DevToolsClientImpl* client = GetBrowserwideClient(session);
+    LOG(INFO) << "DevTools metrics of session " << session->id << ": "
+              << PrettyPrintValue(base::Value(client->CdpMetricsToValue()));
+  }
   if (allow_detach && session->detach)
     return Status(kOk);
   else
@@ -1447,6 +1632,31 @@ Status ExecuteSetTimeZone(Session* session,
   return Status(kOk);
 }
 
+Status ExecuteGetCdpMetrics(Session* session,
+                            const base::DictionaryValue& params,
+                            std::unique_ptr<base::Value>* value) {
+  DevToolsClientImpl* client = GetBrowserwideClient(session);
+  *value = std::make_unique<base::Value>(client->CdpMetricsToValue());
+  return Status(kOk);
+}
+
+Status ExecuteGetCommandLatencies(Session* session,
+                                  const base::DictionaryValue& params,
+                                  std::unique_ptr<base::Value>* value) {
+  base::Value::Dict latencies;
+  for (const auto& [command_name, metrics] : session->command_latencies)
+    latencies.Set(command_name, metrics.ToValue());
+  *value = std::make_unique<base::Value>(std::move(latencies));
+  return Status(kOk);
+}
+
+Status ExecuteGetBidiQueueStats(Session* session,
+                               const base::DictionaryValue& params,
+                               std::unique_ptr<base::Value>* value) {
+  *value = std::make_unique<base::Value>(session->GetBidiQueueStats());
+  return Status(kOk);
+}
+
 // Run a BiDi command
 Status ExecuteBidiCommand(Session* session,
                           const base::DictionaryValue& params,
@@ -1466,34 +1676,67 @@ Status ExecuteBidiCommand(Session* session,
   Status status = session->chrome->GetWebViewById(
       session->bidi_mapper_web_view_id, &web_view);
   if (status.IsError()) {
+    // The BiDiMapper is gone, the pending commands will not get a response.
+    session->ForgetBidiCommandRoutes();
     return status;
   }
 
-  absl::optional<base::Value> dataParsed =
-      base::JSONReader::Read(data, base::JSON_PARSE_CHROMIUM_EXTENSIONS);
-
-  if (!dataParsed) {
-    return Status(kUnknownError, "cannot parse the BiDi command: " + data);
-  }
-
-  if (!dataParsed->is_dict()) {
+  // The command is forwarded to the BiDiMapper as is, only the fields needed
+  // to route it are read.
+  BidiMessageHeader header;
+  if (!PeekBidiMessage(data, &header)) {
     return Status(kUnknownError,
                   "a JSON map is expected as a BiDi command: " + data);
   }
 
-  absl::optional<int> cmd_id = dataParsed->GetDict().FindInt("id");
+  absl::optional<int> cmd_id = header.id;
   if (!cmd_id) {
     return Status(kUnknownError, "BiDi command is missing 'id' field: " + data);
   }
 
-  std::string* method = dataParsed->GetDict().FindString("method");
+  absl::optional<std::string>& method = header.method;
   if (!method) {
     return Status(kUnknownError,
                   "BiDi command is missing 'method' field: " + data);
   }
 
+  // The event filter of the BiDiMapper tab must let the events through before
+  // the BiDiMapper starts emitting them, and may only stop letting them
+  // through once the BiDiMapper has accepted to stop emitting them.
+  bool update_event_filter = !session->accepted_bidi_unsubscribes.empty();
+  for (const std::string& unsubscribe : session->accepted_bidi_unsubscribes)
+    ApplyBidiSubscriptionCommand(session, false, unsubscribe);
+  session->accepted_bidi_unsubscribes.clear();
+  if (*method == "session.subscribe") {
+    ApplyBidiSubscriptionCommand(session, true, data);
+    update_event_filter = true;
+  }
+  if (update_event_filter) {
+    status = SetBidiEventFilter(session, web_view);
+    if (status.IsError())
+      return status;
+  }
+
+  // Commands of an identified connection are forwarded with an id unique to
+  // the session, so that the response can be routed back to the connection.
+  absl::optional<int> connection_id = params.GetDict().FindInt("connectionId");
+  if (connection_id) {
+    cmd_id = session->RouteBidiCommand(*connection_id, *cmd_id);
+    if (!SetBidiMessageId(header, *cmd_id, &data)) {
+      ForgetUnforwardedBidiCommand(session, *cmd_id);
+      return Status(kUnknownError, "cannot route the BiDi command: " + data);
+    }
+  } else if (*cmd_id >= Session::kFirstRoutedBidiCommandId) {
+    // The response would be taken for the one of a routed command.
+    return Status(kInvalidArgument,
+                  "BiDi command 'id' is reserved for routed commands: " + data);
+  }
+  if (*method == "session.unsubscribe")
+    session->pending_bidi_unsubscribes[*cmd_id] = data;
+
   std::string msg;
-  if (!base::JSONWriter::Write(data, &msg)) {
+  if (!base::EscapeJSONString(data, true, &msg)) {
+    ForgetUnforwardedBidiCommand(session, *cmd_id);
     return Status(kUnknownError, "cannot serialize be BiDi command: " + data);
   }
   std::string expression = "onBidiMessage(" + msg + ")";
@@ -1511,6 +1754,7 @@ Status ExecuteBidiCommand(Session* session,
             },
             base::Unretained(session), *cmd_id);
     if (status.IsError()) {
+      ForgetUnforwardedBidiCommand(session, *cmd_id);
       return status;
     }
 
@@ -1520,6 +1764,7 @@ Status ExecuteBidiCommand(Session* session,
     if (status.code() == kTimeout) {
       // It looks like something is going wrong with the BiDiMapper.
       // Terminating the session...
+      session->ForgetBidiCommandRoutes();
       session->quit = true;
       status = session->chrome->Quit();
       return Status(kUnknownError, "failed to close window in 20 seconds");
@@ -1540,6 +1785,8 @@ Status ExecuteBidiCommand(Session* session,
     }
   } else {
     status = web_view->EvaluateScript(std::string(), expression, false, value);
+    if (status.IsError())
+      ForgetUnforwardedBidiCommand(session, *cmd_id);
   }
 
   return status;
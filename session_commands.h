@@ -174,6 +174,24 @@ Status ExecuteSetTimeZone(Session* session,
                           const base::DictionaryValue& params,
                           std::unique_ptr<base::Value>* value);
 
+// Returns the DevTools protocol metrics of the session, see
+// DevToolsClientImpl::CdpMetricsToValue.
+Status ExecuteGetCdpMetrics(Session* session,
+                            const base::DictionaryValue& params,
+                            std::unique_ptr<base::Value>* value);
+
+// Returns the latencies of the commands executed by the session, keyed by the
+// command name, see CommandLatencyMetrics::ToValue.
+Status ExecuteGetCommandLatencies(Session* session,
+                                  const base::DictionaryValue& params,
+                                  std::unique_ptr<base::Value>* value);
+
+// Returns the state of the queue of BiDi messages kept while no connection is
+// open, see Session::GetBidiQueueStats.
+Status ExecuteGetBidiQueueStats(Session* session,
+                                const base::DictionaryValue& params,
+                                std::unique_ptr<base::Value>* value);
+
 // Run a BiDi command
 Status ExecuteBidiCommand(Session* session,
                           const base::DictionaryValue& params,
@@ -6,13 +6,16 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/callback.h"
+#include "base/callback_helpers.h"
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
 #include "base/json/json_reader.h"
 #include "base/run_loop.h"
+#include "base/strings/stringprintf.h"
 #include "base/system/sys_info.h"
 #include "base/threading/thread.h"
 #include "base/values.h"
@@ -712,3 +715,134 @@ TEST(SessionCommandsTest, ConfigureSession_legacyDefault) {
   // legacy values:
   ASSERT_EQ(kIgnore, session.unhandled_prompt_behavior);
 }
+
+namespace {
+
+class RecordingWebView : public StubWebView {
+ public:
+  RecordingWebView() : StubWebView("1") {}
+  ~RecordingWebView() override = default;
+
+  Status CallFunction(const std::string& frame,
+                      const std::string& function,
+                      const base::Value::List& args,
+                      std::unique_ptr<base::Value>* result) override {
+    call_args_.push_back(args.Clone());
+    return Status(kOk);
+  }
+
+  Status EvaluateScript(const std::string& frame,
+                        const std::string& expression,
+                        const bool await_promise,
+                        std::unique_ptr<base::Value>* result) override {
+    return evaluate_status_;
+  }
+
+  std::vector<base::Value::List> call_args_;
+  Status evaluate_status_{kOk};
+};
+
+class BidiMapperChrome : public StubChrome {
+ public:
+  BidiMapperChrome() = default;
+  ~BidiMapperChrome() override = default;
+
+  Status GetWebViewById(const std::string& id, WebView** web_view) override {
+    *web_view = &web_view_;
+    return Status(kOk);
+  }
+
+  RecordingWebView web_view_;
+};
+
+}  // namespace
+
+TEST(SessionCommandsTest, ExecuteBidiCommandTracksSubscriptions) {
+  BidiMapperChrome* chrome = new BidiMapperChrome();
+  Session session("id", std::unique_ptr<Chrome>(chrome));
+  std::unique_ptr<base::Value> value;
+
+  base::DictionaryValue params;
+  params.GetDict().Set(
+      "bidiCommand",
+      R"({"id": 1, "method": "session.subscribe", "params": {)"
+      R"("events": ["log", "browsingContext.load"], "contexts": ["A"]}})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  ASSERT_EQ(2U, session.bidi_subscriptions.size());
+  ASSERT_EQ(1U, session.bidi_subscriptions["log"].count("A"));
+  ASSERT_EQ(1U, chrome->web_view_.call_args_.size());
+  ASSERT_EQ(2U, chrome->web_view_.call_args_[0][0].GetList().size());
+
+  params.GetDict().Set(
+      "bidiCommand",
+      R"({"id": 2, "method": "session.unsubscribe", "params": {)"
+      R"("events": ["log"], "contexts": ["A"]}})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  // The events are let through until the BiDiMapper accepts the command.
+  ASSERT_EQ(2U, session.bidi_subscriptions.size());
+  ASSERT_EQ(1U, chrome->web_view_.call_args_.size());
+
+  // Other commands leave the subscriptions alone.
+  params.GetDict().Set("bidiCommand",
+                       R"({"id": 3, "method": "session.status"})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  ASSERT_EQ(1U, chrome->web_view_.call_args_.size());
+
+  // The accepted unsubscribe is applied before the next command.
+  session.OnBidiResponse(R"({"id": 2, "result": {}})");
+  params.GetDict().Set("bidiCommand",
+                       R"({"id": 4, "method": "session.status"})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  ASSERT_EQ(1U, session.bidi_subscriptions.size());
+  ASSERT_EQ(1U, session.bidi_subscriptions.count("browsingContext.load"));
+  ASSERT_EQ(2U, chrome->web_view_.call_args_.size());
+  ASSERT_EQ(1U, chrome->web_view_.call_args_[1][0].GetList().size());
+
+  // A rejected unsubscribe is not applied.
+  params.GetDict().Set(
+      "bidiCommand",
+      R"({"id": 5, "method": "session.unsubscribe", "params": {)"
+      R"("events": ["browsingContext.load"]}})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  session.OnBidiResponse(R"({"id": 5, "error": "invalid argument"})");
+  params.GetDict().Set("bidiCommand",
+                       R"({"id": 6, "method": "session.status"})");
+  ASSERT_EQ(kOk, ExecuteBidiCommand(&session, params, &value).code());
+  ASSERT_EQ(1U, session.bidi_subscriptions.size());
+  ASSERT_EQ(2U, chrome->web_view_.call_args_.size());
+}
+
+namespace {
+
+void StoreBidiMessage(std::vector<std::string>* messages,
+                      const std::string& message) {
+  messages->push_back(message);
+}
+
+}  // namespace
+
+TEST(SessionCommandsTest, ExecuteBidiCommandForgetsUnforwardedCommands) {
+  BidiMapperChrome* chrome = new BidiMapperChrome();
+  Session session("id", std::unique_ptr<Chrome>(chrome));
+  std::vector<std::string> messages;
+  session.AddBidiConnection(
+      1, base::BindRepeating(&StoreBidiMessage, &messages), base::DoNothing());
+  std::unique_ptr<base::Value> value;
+
+  chrome->web_view_.evaluate_status_ = Status(kUnknownError);
+  base::DictionaryValue params;
+  params.GetDict().Set("connectionId", 1);
+  params.GetDict().Set(
+      "bidiCommand",
+      R"({"id": 1, "method": "session.unsubscribe", "params": {)"
+      R"("events": ["log"]}})");
+  ASSERT_EQ(kUnknownError,
+            ExecuteBidiCommand(&session, params, &value).code());
+  ASSERT_TRUE(session.pending_bidi_unsubscribes.empty());
+
+  // The route of the command is forgotten: a response with its routed id is
+  // dropped.
+  session.OnBidiResponse(base::StringPrintf(
+      R"({"id": %d, "result": {}})", Session::kFirstRoutedBidiCommandId));
+  ASSERT_TRUE(messages.empty());
+}
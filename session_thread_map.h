@@ -8,6 +8,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "base/threading/thread.h"
 
@@ -16,12 +17,17 @@
 class SessionThreadInfo {
  public:
   SessionThreadInfo(const std::string& name, bool w3c_mode)
-      : thread_(name), w3c_mode_(w3c_mode) {}
-  base::Thread* thread() { return &thread_; }
+      : SessionThreadInfo(std::make_unique<base::Thread>(name), w3c_mode) {}
+  // Takes over an already started |thread|, e.g. one recycled from a
+  // terminated session.
+  SessionThreadInfo(std::unique_ptr<base::Thread> thread, bool w3c_mode)
+      : thread_(std::move(thread)), w3c_mode_(w3c_mode) {}
+  base::Thread* thread() { return thread_.get(); }
+  std::unique_ptr<base::Thread> ReleaseThread() { return std::move(thread_); }
   bool w3cMode() const { return w3c_mode_; }
 
  private:
-  base::Thread thread_;
+  std::unique_ptr<base::Thread> thread_;
   bool w3c_mode_;
 };
 
@@ -7,10 +7,15 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "base/bind.h"
+#include "base/callback_helpers.h"
+#include "base/strings/stringprintf.h"
 #include "chrome/test/chromedriver/chrome/status.h"
 #include "chrome/test/chromedriver/chrome/stub_chrome.h"
 #include "chrome/test/chromedriver/chrome/stub_web_view.h"
+#include "chrome/test/chromedriver/util.h"
 #include "testing/gtest/include/gtest/gtest.h"
 
 namespace {
@@ -101,3 +106,135 @@ TEST(Session, SwitchToTopFrame) {
   session.SwitchToTopFrame();
   ASSERT_EQ(std::string(), session.GetCurrentFrameId());
 }
+
+namespace {
+
+void StoreBidiMessage(std::vector<std::string>* messages,
+                      const std::string& message) {
+  messages->push_back(message);
+}
+
+}  // namespace
+
+TEST(Session, BidiResponsesAreForwardedAsIs) {
+  Session session("1");
+  std::vector<std::string> messages;
+
+  session.OnBidiResponse(R"({"launched": true})");
+  ASSERT_TRUE(session.BidiMapperIsLaunched());
+  session.OnBidiResponse("[1]");
+
+  const std::string event =
+      R"({ "method": "log.entryAdded", "params": {"z": 1, "a": [2.50]} })";
+  session.OnBidiResponse(event);
+  session.AddBidiConnection(
+      1, base::BindRepeating(&StoreBidiMessage, &messages), base::DoNothing());
+  ASSERT_EQ(1U, messages.size());
+  ASSERT_EQ(event, messages[0]);
+
+  session.awaited_bidi_response_id = 5;
+  const std::string response = R"({"result": {"id": 7}, "id": 5})";
+  session.OnBidiResponse(response);
+  ASSERT_EQ(2U, messages.size());
+  ASSERT_EQ(response, messages[1]);
+  ASSERT_EQ(-1, session.awaited_bidi_response_id);
+}
+
+TEST(Session, BidiMessagesAreRoutedToConnections) {
+  Session session("1");
+  std::vector<std::string> messages1;
+  std::vector<std::string> messages2;
+  session.AddBidiConnection(
+      1, base::BindRepeating(&StoreBidiMessage, &messages1), base::DoNothing());
+  session.AddBidiConnection(
+      2, base::BindRepeating(&StoreBidiMessage, &messages2), base::DoNothing());
+
+  // Both connections use the same command id.
+  int routed_id1 = session.RouteBidiCommand(1, 7);
+  int routed_id2 = session.RouteBidiCommand(2, 7);
+  ASSERT_NE(routed_id1, routed_id2);
+
+  session.OnBidiResponse(base::StringPrintf(R"({"id": %d, "result": 2})",
+                                            routed_id2));
+  ASSERT_EQ(0U, messages1.size());
+  ASSERT_EQ(1U, messages2.size());
+  ASSERT_EQ(R"({"id": 7, "result": 2})", messages2[0]);
+
+  const std::string event = R"({"method": "log.entryAdded", "params": {}})";
+  session.OnBidiResponse(event);
+  ASSERT_EQ(1U, messages1.size());
+  ASSERT_EQ(event, messages1[0]);
+  ASSERT_EQ(2U, messages2.size());
+  ASSERT_EQ(event, messages2[1]);
+
+  // The response to a closed connection is dropped, not broadcast.
+  session.RemoveBidiConnection(1);
+  session.OnBidiResponse(base::StringPrintf(R"({"id": %d, "result": 1})",
+                                            routed_id1));
+  ASSERT_EQ(1U, messages1.size());
+  ASSERT_EQ(2U, messages2.size());
+
+  // Routed ids do not collide with the ids of unrouted commands.
+  ASSERT_LE(Session::kFirstRoutedBidiCommandId, routed_id1);
+  ASSERT_LE(Session::kFirstRoutedBidiCommandId, routed_id2);
+  const std::string unrouted_response = R"({"id": 1, "result": 3})";
+  session.OnBidiResponse(unrouted_response);
+  ASSERT_EQ(3U, messages2.size());
+  ASSERT_EQ(unrouted_response, messages2[2]);
+
+  // Forgotten routes are dropped as well.
+  int routed_id3 = session.RouteBidiCommand(2, 8);
+  session.ForgetBidiCommandRoutes();
+  session.OnBidiResponse(base::StringPrintf(R"({"id": %d, "result": 4})",
+                                            routed_id3));
+  ASSERT_EQ(3U, messages2.size());
+}
+
+TEST(Session, BidiQueueCountsDroppedMessages) {
+  Session session("1");
+  session.bidi_queue_capacity = 2;
+  std::vector<std::string> messages;
+
+  const std::string first = R"({"method": "log.entryAdded", "params": 1})";
+  const std::string second = R"({"method": "log.entryAdded", "params": 2})";
+  const std::string third =
+      R"({"method": "browsingContext.load", "params": 3})";
+  session.OnBidiResponse(first);
+  session.OnBidiResponse(second);
+  session.OnBidiResponse(third);
+  session.OnBidiResponse(R"({"id": 1, "result": {}})");
+
+  base::Value::Dict stats = session.GetBidiQueueStats();
+  ASSERT_EQ(2, stats.FindInt("queued"));
+  ASSERT_EQ(2, stats.FindDict("dropped")->FindInt("log.entryAdded"));
+
+  session.AddBidiConnection(
+      1, base::BindRepeating(&StoreBidiMessage, &messages), base::DoNothing());
+  ASSERT_EQ(3U, messages.size());
+  BidiMessageHeader header;
+  ASSERT_TRUE(PeekBidiMessage(messages[0], &header));
+  ASSERT_EQ("goog:chromedriver.droppedMessages", header.method);
+  ASSERT_EQ(third, messages[1]);
+  ASSERT_EQ(R"({"id": 1, "result": {}})", messages[2]);
+}
+
+TEST(Session, BidiQueueDropsNewestMessages) {
+  Session session("1");
+  session.bidi_queue_capacity = 1;
+  session.bidi_queue_policy = kBidiQueueDropNewest;
+  std::vector<std::string> messages;
+
+  const std::string first = R"({"method": "log.entryAdded", "params": 1})";
+  session.OnBidiResponse(first);
+  session.OnBidiResponse(R"({"method": "log.entryAdded", "params": 2})");
+  session.AddBidiConnection(
+      1, base::BindRepeating(&StoreBidiMessage, &messages), base::DoNothing());
+  ASSERT_EQ(2U, messages.size());
+  ASSERT_EQ(first, messages[1]);
+
+  // Drops are reported only once.
+  session.RemoveBidiConnection(1);
+  session.AddBidiConnection(
+      2, base::BindRepeating(&StoreBidiMessage, &messages), base::DoNothing());
+  ASSERT_EQ(2U, messages.size());
+}
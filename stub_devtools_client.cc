@@ -5,7 +5,9 @@
 #include "chrome/test/chromedriver/chrome/stub_devtools_client.h"
 
 #include <memory>
+#include <utility>
 
+#include "base/callback.h"
 #include "base/values.h"
 #include "chrome/test/chromedriver/chrome/status.h"
 
@@ -80,6 +82,32 @@ Status StubDevToolsClient::SendCommandAndIgnoreResponse(
   return SendCommand(method, params);
 }
 
+Status StubDevToolsClient::SendCommandAndGetResultAsync(
+    const std::string& method,
+    const base::DictionaryValue& params,
+    ResultCallback callback) {
+  base::Value result;
+  Status status = SendCommandAndGetResult(method, params, &result);
+  std::move(callback).Run(status, std::move(result));
+  return Status(kOk);
+}
+
+Status StubDevToolsClient::SendCommandBatch(
+    const std::vector<BatchCommand>& commands,
+    std::vector<Status>* statuses) {
+  Status first_error(kOk);
+  if (statuses)
+    statuses->clear();
+  for (const BatchCommand& command : commands) {
+    Status status = SendCommand(command.method, *command.params);
+    if (statuses)
+      statuses->push_back(status);
+    if (first_error.IsOk())
+      first_error = status;
+  }
+  return first_error;
+}
+
 void StubDevToolsClient::AddListener(DevToolsEventListener* listener) {
   listeners_.push_back(listener);
 }
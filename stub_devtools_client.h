@@ -8,6 +8,7 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "chrome/test/chromedriver/chrome/devtools_client.h"
 
@@ -52,6 +53,11 @@ class StubDevToolsClient : public DevToolsClient {
   Status SendCommandAndIgnoreResponse(
       const std::string& method,
       const base::DictionaryValue& params) override;
+  Status SendCommandAndGetResultAsync(const std::string& method,
+                                      const base::DictionaryValue& params,
+                                      ResultCallback callback) override;
+  Status SendCommandBatch(const std::vector<BatchCommand>& commands,
+                          std::vector<Status>* statuses) override;
   void AddListener(DevToolsEventListener* listener) override;
   Status HandleEventsUntil(const ConditionalFunc& conditional_func,
                            const Timeout& timeout) override;
@@ -14,7 +14,10 @@
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/format_macros.h"
+#include "base/json/json_reader.h"
+#include "base/json/json_writer.h"
 #include "base/rand_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
@@ -649,3 +652,164 @@ bool WindowHandleToWebViewId(const std::string& window_handle,
   *web_view_id = window_handle.substr(sizeof(kWindowHandlePrefix) - 1);
   return true;
 }
+
+BidiMessageHeader::BidiMessageHeader() = default;
+
+BidiMessageHeader::BidiMessageHeader(const BidiMessageHeader& other) = default;
+
+BidiMessageHeader& BidiMessageHeader::operator=(
+    const BidiMessageHeader& other) = default;
+
+BidiMessageHeader::~BidiMessageHeader() = default;
+
+namespace {
+
+void SkipJsonWhitespace(base::StringPiece json, size_t* pos) {
+  while (*pos < json.size() && base::IsAsciiWhitespace(json[*pos]))
+    ++*pos;
+}
+
+// Advances |pos| past the JSON value that starts there, without validating
+// it. Returns false if the value is not terminated.
+bool SkipJsonValue(base::StringPiece json, size_t* pos) {
+  int depth = 0;
+  bool in_string = false;
+  for (; *pos < json.size(); ++*pos) {
+    char c = json[*pos];
+    if (in_string) {
+      if (c == '\\') {
+        ++*pos;
+      } else if (c == '"') {
+        in_string = false;
+        if (depth == 0) {
+          ++*pos;
+          return true;
+        }
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0)
+        return true;
+      if (--depth == 0) {
+        ++*pos;
+        return true;
+      }
+    } else if (depth == 0 && (c == ',' || base::IsAsciiWhitespace(c))) {
+      return true;
+    }
+  }
+  return depth == 0 && !in_string;
+}
+
+void SetBidiMessageField(base::StringPiece key,
+                         const base::Value& value,
+                         BidiMessageHeader* header) {
+  if (key == "id") {
+    header->id = value.GetIfInt();
+  } else if (key == "method") {
+    header->method = value.is_string()
+                         ? absl::make_optional(value.GetString())
+                         : absl::nullopt;
+  } else if (key == "launched") {
+    header->launched = value.GetIfBool().value_or(false);
+  } else if (key == "error") {
+    header->error = true;
+  }
+}
+
+// Scans the top-level members of the JSON object |message| and only parses
+// the values of the fields in BidiMessageHeader. Returns false for anything
+// unusual, e.g. escaped keys, in which case the message has to be parsed.
+bool ScanBidiMessage(base::StringPiece message, BidiMessageHeader* header) {
+  size_t pos = 0;
+  SkipJsonWhitespace(message, &pos);
+  if (pos >= message.size() || message[pos] != '{')
+    return false;
+  ++pos;
+  SkipJsonWhitespace(message, &pos);
+  bool is_empty = pos < message.size() && message[pos] == '}';
+  if (is_empty)
+    ++pos;
+  while (!is_empty) {
+    SkipJsonWhitespace(message, &pos);
+    size_t key_start = pos;
+    if (pos >= message.size() || message[pos] != '"' ||
+        !SkipJsonValue(message, &pos)) {
+      return false;
+    }
+    base::StringPiece key =
+        message.substr(key_start + 1, pos - key_start - 2);
+    if (key.find('\\') != base::StringPiece::npos)
+      return false;
+    SkipJsonWhitespace(message, &pos);
+    if (pos >= message.size() || message[pos] != ':')
+      return false;
+    ++pos;
+    SkipJsonWhitespace(message, &pos);
+    size_t value_start = pos;
+    if (!SkipJsonValue(message, &pos) || pos == value_start)
+      return false;
+    if (key == "error") {
+      header->error = true;
+    } else if (key == "id" || key == "method" || key == "launched") {
+      absl::optional<base::Value> value = base::JSONReader::Read(
+          message.substr(value_start, pos - value_start));
+      if (!value)
+        return false;
+      SetBidiMessageField(key, *value, header);
+      if (key == "id") {
+        header->id_offset = value_start;
+        header->id_length = pos - value_start;
+      }
+    }
+    SkipJsonWhitespace(message, &pos);
+    if (pos >= message.size())
+      return false;
+    if (message[pos] == '}') {
+      ++pos;
+      break;
+    }
+    if (message[pos] != ',')
+      return false;
+    ++pos;
+  }
+  SkipJsonWhitespace(message, &pos);
+  return pos == message.size();
+}
+
+}  // namespace
+
+bool PeekBidiMessage(base::StringPiece message, BidiMessageHeader* header) {
+  *header = BidiMessageHeader();
+  if (ScanBidiMessage(message, header))
+    return true;
+
+  *header = BidiMessageHeader();
+  absl::optional<base::Value> parsed =
+      base::JSONReader::Read(message, base::JSON_PARSE_CHROMIUM_EXTENSIONS);
+  if (!parsed || !parsed->is_dict())
+    return false;
+  for (const auto [key, value] : parsed->GetDict())
+    SetBidiMessageField(key, value, header);
+  return true;
+}
+
+bool SetBidiMessageId(const BidiMessageHeader& header,
+                      int id,
+                      std::string* message) {
+  if (header.id_length) {
+    message->replace(header.id_offset, header.id_length,
+                     base::NumberToString(id));
+    return true;
+  }
+
+  absl::optional<base::Value> parsed =
+      base::JSONReader::Read(*message, base::JSON_PARSE_CHROMIUM_EXTENSIONS);
+  if (!parsed || !parsed->is_dict())
+    return false;
+  parsed->GetDict().Set("id", id);
+  return base::JSONWriter::Write(*parsed, message);
+}
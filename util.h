@@ -5,9 +5,13 @@
 #ifndef CHROME_TEST_CHROMEDRIVER_UTIL_H_
 #define CHROME_TEST_CHROMEDRIVER_UTIL_H_
 
+#include <stddef.h>
+
 #include <string>
 
+#include "base/strings/string_piece.h"
 #include "base/values.h"
+#include "third_party/abseil-cpp/absl/types/optional.h"
 
 namespace base {
 class FilePath;
@@ -107,4 +111,34 @@ std::string WebViewIdToWindowHandle(const std::string& web_view_id);
 bool WindowHandleToWebViewId(const std::string& window_handle,
                              std::string* web_view_id);
 
+// Top-level fields of a BiDi message that ChromeDriver routes the message by.
+struct BidiMessageHeader {
+  BidiMessageHeader();
+  BidiMessageHeader(const BidiMessageHeader& other);
+  BidiMessageHeader& operator=(const BidiMessageHeader& other);
+  ~BidiMessageHeader();
+
+  // Set for commands and command responses, unset for events.
+  absl::optional<int> id;
+  absl::optional<std::string> method;
+  // Set by the BiDiMapper once it is ready.
+  bool launched = false;
+  // Whether the message is an error response.
+  bool error = false;
+  // Byte range of the value of "id" in the message, if it was located.
+  size_t id_offset = 0;
+  size_t id_length = 0;
+};
+
+// Reads the "id", "method", "launched" and "error" fields of the JSON object
+// |message| without building values for the rest of it, so that the message
+// can be forwarded as is. Returns false if |message| is not a JSON object.
+bool PeekBidiMessage(base::StringPiece message, BidiMessageHeader* header);
+
+// Replaces the "id" of |message|, whose fields were read into |header|, with
+// |id|. Only the bytes of the old id are rewritten when they were located.
+bool SetBidiMessageId(const BidiMessageHeader& header,
+                      int id,
+                      std::string* message);
+
 #endif  // CHROME_TEST_CHROMEDRIVER_UTIL_H_
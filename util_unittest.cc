@@ -365,3 +365,60 @@ TEST(ConvertCentimeterToInch, NegativeDouble) {
   ASSERT_EQ(-1, ConvertCentimeterToInch(-2.54));
   ASSERT_EQ(-0.1, ConvertCentimeterToInch(-0.254));
 }
+
+TEST(PeekBidiMessage, ReadsTopLevelFields) {
+  BidiMessageHeader header;
+  ASSERT_TRUE(PeekBidiMessage(
+      R"( {"params": {"id": 2, "method": "x", "s": "}\"{"},)"
+      R"( "id": 1, "method": "session.status"} )",
+      &header));
+  ASSERT_EQ(1, header.id);
+  ASSERT_EQ("session.status", header.method);
+  ASSERT_FALSE(header.launched);
+  ASSERT_FALSE(header.error);
+
+  ASSERT_TRUE(PeekBidiMessage(
+      R"({"id": 2, "error": "unknown command", "message": "x"})", &header));
+  ASSERT_EQ(2, header.id);
+  ASSERT_TRUE(header.error);
+
+  ASSERT_TRUE(PeekBidiMessage(R"({"launched": true})", &header));
+  ASSERT_FALSE(header.id);
+  ASSERT_FALSE(header.method);
+  ASSERT_TRUE(header.launched);
+
+  ASSERT_TRUE(PeekBidiMessage("{}", &header));
+  ASSERT_FALSE(header.id);
+}
+
+TEST(PeekBidiMessage, ParsesUnusualMessages) {
+  BidiMessageHeader header;
+  // Escaped keys are left to the JSON parser.
+  ASSERT_TRUE(PeekBidiMessage(R"({"\u0069d": 3})", &header));
+  ASSERT_EQ(3, header.id);
+  // Non-integer ids are not ids.
+  ASSERT_TRUE(PeekBidiMessage(R"({"id": 1.5, "method": 2})", &header));
+  ASSERT_FALSE(header.id);
+  ASSERT_FALSE(header.method);
+}
+
+TEST(PeekBidiMessage, RejectsNonObjects) {
+  BidiMessageHeader header;
+  ASSERT_FALSE(PeekBidiMessage("[1]", &header));
+  ASSERT_FALSE(PeekBidiMessage(R"({"id": 1)", &header));
+  ASSERT_FALSE(PeekBidiMessage(R"({"id": 1} x)", &header));
+}
+
+TEST(SetBidiMessageId, RewritesOnlyTheId) {
+  BidiMessageHeader header;
+  std::string message = R"({"id": 12, "params": {"id": 12}})";
+  ASSERT_TRUE(PeekBidiMessage(message, &header));
+  ASSERT_TRUE(SetBidiMessageId(header, 3, &message));
+  ASSERT_EQ(R"({"id": 3, "params": {"id": 12}})", message);
+
+  message = R"({"id": 12})";
+  ASSERT_TRUE(PeekBidiMessage(message, &header));
+  ASSERT_TRUE(SetBidiMessageId(header, 3, &message));
+  ASSERT_TRUE(PeekBidiMessage(message, &header));
+  ASSERT_EQ(3, header.id);
+}